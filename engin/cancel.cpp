@@ -0,0 +1,92 @@
+#include "cancel.hpp"
+#include "chroutine.hpp"
+
+namespace chr {
+
+void cancel_state_t::cancel()
+{
+    std::vector<std::weak_ptr<cancel_state_t> > children;
+    std::vector<int64_t> chroutines;
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        if (m_cancelled.load(std::memory_order_relaxed)) {
+            return;
+        }
+        m_cancelled.store(true, std::memory_order_release);
+        std::swap(children, m_children);
+        // the list is left as it is, detach doesn't touch it since now
+        chroutines.reserve(m_chroutines.size());
+        for (auto &attached : m_chroutines) {
+            chroutines.push_back(attached.id);
+        }
+    }
+
+    for (auto &weak : children) {
+        sptr_t child = weak.lock();
+        if (child) {
+            child->cancel();
+        }
+    }
+
+    // the ones sleeping or parked would not see it till they wake up
+    for (auto id : chroutines) {
+        chroutine_thread_t *owner = chroutine_table_t::owner(id);
+        if (owner) {
+            owner->interrupt_chroutine(id);
+        }
+    }
+}
+
+void cancel_state_t::add_child(const sptr_t & child)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        if (!m_cancelled.load(std::memory_order_relaxed)) {
+            // drop the finished ones now and then, a long lived token may have many sons
+            if (m_children.size() >= 2 * m_children_pruned + 16) {
+                size_t alive = 0;
+                for (size_t i = 0; i < m_children.size(); i++) {
+                    if (!m_children[i].expired()) {
+                        m_children[alive++] = m_children[i];
+                    }
+                }
+                m_children.resize(alive);
+                m_children_pruned = alive;
+            }
+            m_children.push_back(child);
+            return;
+        }
+    }
+    child->cancel();
+}
+
+void cancel_state_t::attach(int64_t id, size_t *slot)
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    *slot = m_chroutines.size();
+    attached_t attached;
+    attached.id = id;
+    attached.slot = slot;
+    m_chroutines.push_back(attached);
+}
+
+void cancel_state_t::detach(size_t *slot)
+{
+    // cancel() took its copy, and the ones ending after it needn't leave the list
+    if (m_cancelled.load(std::memory_order_acquire)) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(m_lock);
+    if (m_cancelled.load(std::memory_order_relaxed)) {
+        return;
+    }
+    // the last one takes its place
+    size_t index = *slot;
+    if (index + 1 < m_chroutines.size()) {
+        m_chroutines[index] = m_chroutines.back();
+        *m_chroutines[index].slot = index;
+    }
+    m_chroutines.pop_back();
+}
+
+}
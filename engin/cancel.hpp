@@ -0,0 +1,198 @@
+/// \file cancel.hpp
+///
+/// cancel_token_t cancels a tree of chroutines, by a call or by a deadline.
+///
+/// a chroutine runs under a token of its own, a child of the token it's created with
+/// (chroutine_attr_t::token), and a son's token is also a child of its father's.
+/// cancelling a token cancels its children, and a child's deadline is never later than its parents'.
+/// WAIT cancels the son with the deadline of the wait, instead of dropping it.
+///
+/// a cancelled chroutine is woken if it's sleeping or parked, and the next suspension
+/// point it meets (SLEEP, WAIT, YIELD, park, PREEMPT_POINT, and channels, futures, curl, gRPC
+/// built on them) throws chroutine_cancelled_t. it unwinds to the entry of the chroutine,
+/// running the destructors on the way, and the chroutine ends there.
+/// a computing loop without suspension points checks ENGIN.cancelled() by itself.
+///
+/// \author ingangi
+/// \version 0.1.0
+/// \date 2026-10-17
+
+#ifndef CANCEL_HPP
+#define CANCEL_HPP
+
+#include <stdint.h>
+#include <ctime>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <exception>
+#include "mono_clock.hpp"
+
+namespace chr {
+
+typedef enum {
+    cancel_none = 0,
+    cancel_called,      // cancel() of it or a parent
+    cancel_deadline,    // its deadline passed
+} cancel_reason_t;
+
+// thrown by a suspension point of a cancelled chroutine, caught at its entry.
+// catch it to clean up if you must, but throw it again.
+class chroutine_cancelled_t : public std::exception
+{
+public:
+    explicit chroutine_cancelled_t(cancel_reason_t reason) : m_reason(reason) {}
+
+    cancel_reason_t reason() const {
+        return m_reason;
+    }
+
+    virtual const char *what() const noexcept {
+        return m_reason == cancel_deadline ? "chroutine deadline exceeded" : "chroutine cancelled";
+    }
+
+private:
+    cancel_reason_t m_reason;
+};
+
+class cancel_state_t final
+{
+public:
+    typedef std::shared_ptr<cancel_state_t> sptr_t;
+
+    explicit cancel_state_t(std::time_t deadline_us) : m_deadline(deadline_us) {}
+
+    // cancelled by a call, or timed out
+    bool cancelled() const {
+        return reason() != cancel_none;
+    }
+
+    cancel_reason_t reason() const {
+        if (m_cancelled.load(std::memory_order_acquire)) {
+            return cancel_called;
+        }
+        if (m_deadline != 0 && mono_clock_t::round_us() >= m_deadline) {
+            return cancel_deadline;
+        }
+        return cancel_none;
+    }
+
+    // in us of mono_clock_t, 0: none
+    std::time_t deadline() const {
+        return m_deadline;
+    }
+
+    // cancel it and its children, and wake the chroutines under them
+    void cancel();
+
+    // cancel @child with me, at once if I'm cancelled already
+    void add_child(const sptr_t & child);
+
+    // wake chroutine @id when I'm cancelled.
+    // @slot keeps its index in my list till detached, so detach is O(1):
+    // a token may be shared by many chroutines, which end one by one when it's cancelled.
+    void attach(int64_t id, size_t *slot);
+    void detach(size_t *slot);
+
+private:
+    typedef struct attached_t {
+        int64_t     id;
+        size_t *    slot;   // where the chroutine keeps its index in m_chroutines
+    } attached_t;
+
+    cancel_state_t(const cancel_state_t&) = delete;
+    cancel_state_t& operator=(const cancel_state_t&) = delete;
+
+private:
+    const std::time_t   m_deadline;
+    std::atomic<bool>   m_cancelled{false};
+
+    std::mutex                          m_lock;
+    std::vector<std::weak_ptr<cancel_state_t> > m_children;
+    size_t                              m_children_pruned = 0;  // size after the last pruning
+    std::vector<attached_t>             m_chroutines;
+};
+
+// a handle of a cancel_state_t, copyable. an empty one is never cancelled.
+class cancel_token_t final
+{
+public:
+    cancel_token_t() {}
+
+    // a new token, timing out in @timeout_ms (0: never)
+    static cancel_token_t create(std::time_t timeout_ms = 0) {
+        return cancel_token_t(std::make_shared<cancel_state_t>(after(timeout_ms)));
+    }
+
+    // a child of mine (and of @other if it's not empty), timing out in @timeout_ms (0: when we do)
+    cancel_token_t child(std::time_t timeout_ms = 0, const cancel_token_t & other = cancel_token_t()) const {
+        std::time_t deadline = earlier(after(timeout_ms), earlier(deadline_us(), other.deadline_us()));
+        cancel_token_t token(std::make_shared<cancel_state_t>(deadline));
+        if (m_state) {
+            m_state->add_child(token.m_state);
+        }
+        if (other.m_state) {
+            other.m_state->add_child(token.m_state);
+        }
+        return token;
+    }
+
+    bool valid() const {
+        return m_state.get() != nullptr;
+    }
+
+    bool cancelled() const {
+        return m_state && m_state->cancelled();
+    }
+
+    cancel_reason_t reason() const {
+        return m_state ? m_state->reason() : cancel_none;
+    }
+
+    // in us of mono_clock_t, 0: none
+    std::time_t deadline_us() const {
+        return m_state ? m_state->deadline() : 0;
+    }
+
+    // the ms left till the deadline, 0 if none, 1 at least if there is
+    std::time_t left_ms() const {
+        std::time_t deadline = deadline_us();
+        if (deadline == 0) {
+            return 0;
+        }
+        std::time_t left = (deadline - mono_clock_t::round_us() + 999) / 1000;
+        return left > 0 ? left : 1;
+    }
+
+    void cancel() const {
+        if (m_state) {
+            m_state->cancel();
+        }
+    }
+
+    const cancel_state_t::sptr_t & state() const {
+        return m_state;
+    }
+
+private:
+    explicit cancel_token_t(const cancel_state_t::sptr_t & state) : m_state(state) {}
+
+    static std::time_t after(std::time_t timeout_ms) {
+        return timeout_ms > 0 ? mono_clock_t::round_us() + timeout_ms * 1000 : 0;
+    }
+
+    static std::time_t earlier(std::time_t a, std::time_t b) {
+        if (a == 0 || (b != 0 && b < a)) {
+            return b;
+        }
+        return a;
+    }
+
+private:
+    cancel_state_t::sptr_t  m_state;
+};
+
+}
+
+#endif
@@ -2,6 +2,10 @@
 /// 
 /// channel_t is for the communication between chroutines
 ///
+/// the context of a waiting reader or writer is taken from the slab, not from its stack:
+/// the peer writes it while the waiter is switched out, and the stack of a
+/// shared-stack chroutine holds the frames of another one by then.
+///
 /// \author ingangi
 /// \version 0.1.0
 /// \date 2019-03-26
@@ -9,10 +13,12 @@
 #ifndef CHANNEL_H
 #define CHANNEL_H
 
+#include <atomic>
 #include <deque>
 #include "chroutine.hpp"
 #include "chutex.hpp"
 #include "engine.hpp"
+#include "slab.hpp"
 
 namespace chr {
 
@@ -33,12 +39,18 @@ public:
 template<typename T>
 class channel_t final : public channel_it
 {
-    typedef struct
+    typedef struct chroutine_chan_context_t
     {
-        std::thread::id thread_id;
         chroutine_id_t  chrotine_id = INVALID_ID;
-        T *             out_ptr = nullptr;
-        T               in_data;
+        T               data;                   // to write, or read, copied out by the reader
+        std::atomic<bool> served{false};        // set by the peer when the data is passed
+
+        static void *operator new(size_t size) {
+            return slab_t<chroutine_chan_context_t>::alloc();
+        }
+        static void operator delete(void *p) {
+            slab_t<chroutine_chan_context_t>::free(p);
+        }
     }chroutine_chan_context_t;
 
 public:
@@ -99,25 +111,27 @@ public:
                 return false;
             }
             // add to m_waiting_write_que
-            chroutine_chan_context_t ctx;
-            ctx.thread_id = std::this_thread::get_id();
-            ctx.chrotine_id = ENGIN.get_current_chroutine_id();
-            ctx.in_data = data;
-            m_waiting_write_que.push_back(ctx);
+            std::unique_ptr<chroutine_chan_context_t> ctx(new chroutine_chan_context_t());
+            ctx->chrotine_id = ENGIN.get_current_chroutine_id();
+            ctx->data = data;
+            m_waiting_write_que.push_back(ctx.get());
             m_lock.unlock();
-            // block the chroutine
-            HOLD();
+            // block the chroutine till a reader takes the data
+            wait_served(m_waiting_write_que, *ctx);
             return true;
         }
 
         // if some one is waiting, give him the data directly
         if (!m_waiting_read_que.empty()) {
-            chroutine_chan_context_t &context = m_waiting_read_que.front();
-            *(context.out_ptr) = data;
-            // wake the chroutine
-            ENGIN.awake_chroutine(context.thread_id, context.chrotine_id);
+            chroutine_chan_context_t *context = m_waiting_read_que.front();
             m_waiting_read_que.pop_front();
+            // the reader may free it once served
+            chroutine_id_t reader = context->chrotine_id;
+            context->data = data;
+            context->served.store(true);
             m_lock.unlock();
+            // wake the chroutine
+            ENGIN.unpark(reader);
             return true;
         }
 
@@ -137,14 +151,13 @@ public:
                 return false;
             }
             // add to m_waiting_read_que
-            chroutine_chan_context_t ctx;
-            ctx.thread_id = std::this_thread::get_id();
-            ctx.chrotine_id = ENGIN.get_current_chroutine_id();
-            ctx.out_ptr = &data;
-            m_waiting_read_que.push_back(ctx);
+            std::unique_ptr<chroutine_chan_context_t> ctx(new chroutine_chan_context_t());
+            ctx->chrotine_id = ENGIN.get_current_chroutine_id();
+            m_waiting_read_que.push_back(ctx.get());
             m_lock.unlock();
-            // block the chroutine
-            HOLD();
+            // block the chroutine till a writer gives the data
+            wait_served(m_waiting_read_que, *ctx);
+            data = ctx->data;
             return true;
         }
 
@@ -152,19 +165,53 @@ public:
         m_unread--;
         m_r_index = (m_r_index + 1) % m_max_size;
 
-        // if some one is waiting for write
+        // if some one is waiting for write, move its data into the slot just freed
+        chroutine_id_t writer = INVALID_ID;
         if (!m_waiting_write_que.empty()) {
-            chroutine_chan_context_t &context = m_waiting_write_que.front();
-            *this <<  context.in_data;
-            // wake the chroutine
-            ENGIN.awake_chroutine(context.thread_id, context.chrotine_id);
+            chroutine_chan_context_t *context = m_waiting_write_que.front();
             m_waiting_write_que.pop_front();
+            m_data_array[m_w_index] = context->data;
+            m_unread++;
+            m_w_index = (m_w_index + 1) % m_max_size;
+            // the writer may free it once served
+            writer = context->chrotine_id;
+            context->served.store(true);
         }
         m_lock.unlock();
+        // wake the chroutine
+        if (writer != INVALID_ID) {
+            ENGIN.unpark(writer);
+        }
         return true;
     }
     
 private:
+    // park till the peer sets @ctx served, the unpark may come before the park, or a park may return
+    // early (awake_chroutine), so check it every time.
+    // if it's cancelled, leave @que before unwinding, the caller frees @ctx then.
+    void wait_served(std::deque<chroutine_chan_context_t *> & que, chroutine_chan_context_t & ctx) {
+        try {
+            while (!ctx.served.load()) {
+                ENGIN.park();
+            }
+        } catch (const chroutine_cancelled_t &) {
+            cancel_shield_t shield;
+            m_lock.lock();
+            bool passed = ctx.served.load();
+            for (auto it = que.begin(); !passed && it != que.end(); ++it) {
+                if (*it == &ctx) {
+                    que.erase(it);
+                    break;
+                }
+            }
+            m_lock.unlock();
+            // the data was passed already, the next suspension point throws again
+            if (!passed) {
+                throw;
+            }
+        }
+    }
+
     channel_t(const channel_t&) = delete;
     channel_t(channel_t&&) = delete;
     channel_t& operator=(const channel_t&) = delete;
@@ -179,8 +226,8 @@ private:
     T *     m_data_array = nullptr;
     int     m_unread = 0;
     
-    std::deque<chroutine_chan_context_t> m_waiting_write_que;
-    std::deque<chroutine_chan_context_t> m_waiting_read_que;
+    std::deque<chroutine_chan_context_t *> m_waiting_write_que;
+    std::deque<chroutine_chan_context_t *> m_waiting_read_que;
     
     chutex_t    m_lock;
 };
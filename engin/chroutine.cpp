@@ -1,70 +1,55 @@
 #include <unistd.h>
+#include <stdlib.h>
+#include <poll.h>
+#include <chrono>
+#include <sys/eventfd.h>
 #include <iostream>
-#include <algorithm>    // std::swap
 #include "chroutine.hpp"
 #include "engine.hpp"
 
 
 namespace chr {
 
-std::atomic<chroutine_id_t> chroutine_thread_t::ms_chroutine_id(0);
+thread_local chroutine_thread_t * chroutine_thread_t::ms_current = nullptr;
+thread_local chroutine_t * chroutine_thread_t::ms_running = nullptr;
+thread_local volatile sig_atomic_t chroutine_thread_t::ms_preemptible = 0;
 
-chroutine_t::chroutine_t(chroutine_id_t id) : me(id)
+chroutine_t::chroutine_t() : me(chroutine_table_t::attach(this))
 {
+    timer.owner = this;
     SPDLOG(TRACE, "chroutine_t created: {}", me);
-    stack = new char[STACK_SIZE];
-    ctx = new ucontext_t;
 }
 
 chroutine_t::~chroutine_t() 
 {
     SPDLOG(TRACE, "chroutine_t destroyed: {}", me);
-    delete [] stack;
-    delete ctx;
-}
-
-chroutine_t::chroutine_t(chroutine_t &&other)
-{
-    SPDLOG(DEBUG, "chroutine_t created: {} (by move constructor)", other.me);
-    std::swap(ctx, other.ctx);
-    func = std::move(other.func);
-    arg = other.arg;
-    state = other.state;
-    std::swap(stack, other.stack);
-    yield_wait = other.yield_wait;
-    yield_to = other.yield_to;
-    me = other.me;
-    father = other.father;
-    son = other.son;
-    reporter = other.reporter;
-    stop_son_when_yield_over = other.stop_son_when_yield_over;
-}
-
-int chroutine_t::wait(std::time_t now) 
-{
-    if (yield_wait > 0)
-        return yield_wait--;
-    
-    if (yield_to != 0 && yield_to > now)
-        return 1;
-
-    return 0;
+    chroutine_table_t::detach(me);
+    // here rather than at the end of entry, as one may never run
+    if (token.valid()) {
+        token.state()->detach(&token_slot);
+    }
+    if (painted && !stack.empty()) {
+        stack_pool_t::record_usage(tag, stack);
+    }
+    stack_pool_t::release(stack);
+    delete [] save_buf;
 }
 
-chroutine_id_t chroutine_t::yield_over(son_result_t result) 
+cancel_token_t chroutine_t::yield_over(son_result_t result) 
 {
-    chroutine_id_t timeout_chroutine = INVALID_ID;
+    cancel_token_t timeout_son;
     if (yield_to != 0 && stop_son_when_yield_over) {
         if (reporter.get()) {
             reporter.get()->set_result(result);
         }
-        timeout_chroutine = son;
+        timeout_son = son_token;
         son = INVALID_ID;
+        son_token = cancel_token_t();
         stop_son_when_yield_over = false;
     }
 
     yield_to = 0;
-    return timeout_chroutine;
+    return timeout_son;
 }
 
 void chroutine_t::son_finished() 
@@ -72,6 +57,7 @@ void chroutine_t::son_finished()
     if (reporter.get()) {
         reporter.get()->set_result(result_done);
     }
+    son_token = cancel_token_t();
     yield_to = 0;
 }
 
@@ -80,6 +66,51 @@ reporter_base_t *chroutine_t::get_reporter()
     return reporter.get();
 }
 
+chroutine_t *ready_queue_t::pick()
+{
+    // a starving class first, the highest one if several
+    for (int c = 1; c < PRIORITY_CLASSES; c++) {
+        if (passed[c] >= STARVE_PICKS && !lists[c].empty()) {
+            chroutine_t *co = pick_from(c);
+            if (co) {
+                return co;
+            }
+        }
+    }
+    for (int c = 0; c < PRIORITY_CLASSES; c++) {
+        chroutine_t *co = pick_from(c);
+        if (co) {
+            return co;
+        }
+    }
+    return nullptr;
+}
+
+chroutine_t *ready_queue_t::pick_from(int c)
+{
+    // skip a round for each tick left
+    chroutine_t *picked = nullptr;
+    for (size_t count = lists[c].size(); count > 0; count--) {
+        chroutine_t *co = lists[c].pop_front();
+        if (co->yield_wait > 0) {
+            co->yield_wait--;
+            lists[c].push_back(co);
+            continue;
+        }
+        picked = co;
+        break;
+    }
+    if (picked == nullptr) {
+        return nullptr;
+    }
+
+    passed[c] = 0;
+    for (int lower = c + 1; lower < PRIORITY_CLASSES; lower++) {
+        passed[lower] = lists[lower].empty() ? 0 : passed[lower] + 1;
+    }
+    return picked;
+}
+
 std::shared_ptr<chroutine_thread_t> chroutine_thread_t::new_thread()
 {
     return std::shared_ptr<chroutine_thread_t>(new chroutine_thread_t());
@@ -89,70 +120,302 @@ chroutine_thread_t::chroutine_thread_t()
 {
     set_state(thread_state_t_init);
     clear_entry_time();
+    m_kick_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (m_kick_fd < 0) {
+        SPDLOG(ERROR, "chroutine_thread_t {:p} eventfd failed: {}, idle thread will poll", (void*)this, errno);
+    }
 }
 
 chroutine_thread_t::~chroutine_thread_t()
-{}
+{
+    stack_pool_t::release(m_shared_stack);
+    drop_inbox();
+    if (m_kick_fd >= 0) {
+        close(m_kick_fd);
+    }
+}
 
 void chroutine_thread_t::yield(int tick)
 {
     yield_current(tick);
 }
 
+// the whole ms deadlines are kept in the ms wheel, as they used to be.
+// the deadlines start from the time cached by this round, see mono_clock_t
 void chroutine_thread_t::wait(std::time_t wait_time_ms)
 {
-    wait_current(wait_time_ms, true);
+    if (wait_time_ms > 0)
+        wait_current((mono_clock_t::cached_ms() + wait_time_ms) * 1000, true);
 }
 
 void chroutine_thread_t::sleep(std::time_t wait_time_ms)
 {
-    wait_current(wait_time_ms, false);
+    if (wait_time_ms > 0)
+        wait_current((mono_clock_t::cached_ms() + wait_time_ms) * 1000, false);
+}
+
+void chroutine_thread_t::wait_us(std::time_t wait_time_us)
+{
+    if (wait_time_us > 0)
+        wait_current(mono_clock_t::cached_us() + wait_time_us, true);
+}
+
+void chroutine_thread_t::sleep_us(std::time_t wait_time_us)
+{
+    if (wait_time_us > 0)
+        wait_current(mono_clock_t::cached_us() + wait_time_us, false);
 }
 
 chroutine_t * chroutine_thread_t::get_chroutine(chroutine_id_t id)
 {
-    chutex_guard_t lock(m_chroutine_lock);
+    preempt_off_t off;
+    std::lock_guard<std::mutex> lock(m_chroutine_lock);
+    return find(id);
+}
 
-    auto iter = m_schedule.chroutines_map.find(id);
-    if (iter == m_schedule.chroutines_map.end()) {
+chroutine_t * chroutine_thread_t::find(chroutine_id_t id)
+{
+    chroutine_t *co = chroutine_table_t::get(id);
+    if (co == nullptr || chroutine_table_t::owner(id) != this || !chroutine_owned_list_t::linked(co)) {
         return nullptr;
     }
-
-    return iter->second.get();
+    return co;
 }
 
 void chroutine_thread_t::clear_all_chroutine()
 {
-    chutex_guard_t lock(m_chroutine_lock);
-    m_schedule.chroutines_map.clear();
-    m_schedule.chroutines_to_free.clear();
-    m_schedule.chroutines_sched.clear();
+    chroutine_owned_list_t to_free_owned;
+    chroutine_list_t to_free;
+    {
+        std::lock_guard<std::mutex> lock(m_chroutine_lock);
+        m_shared_stack_owner = nullptr;
+        while (!m_schedule.chroutines_ready.empty()) {
+            m_schedule.chroutines_ready.pop_front();
+        }
+        for (chroutine_t *co = m_schedule.chroutines_owned.front(); co; co = chroutine_owned_list_t::next(co)) {
+            cancel_sleep(co);
+            chroutine_table_t::set_owner(co->id(), nullptr);
+        }
+        std::swap(to_free, m_schedule.chroutines_to_free);
+        std::swap(to_free_owned, m_schedule.chroutines_owned);
+    }
+
+    while (!to_free.empty()) {
+        chroutine_ptr_t(to_free.pop_front(), false);
+    }
+    while (!to_free_owned.empty()) {
+        chroutine_ptr_t(to_free_owned.pop_front(), false);
+    }
+    drop_inbox();
+}
+
+void chroutine_thread_t::make_ready(chroutine_t *co)
+{
+    cancel_sleep(co);
+    co->parking = false;
+    if (chroutine_list_t::linked(co) || co->id() == m_schedule.running_id) {
+        return;
+    }
+    m_schedule.chroutines_ready.push_back(co);
+    update_ready_depth();
+}
+
+void chroutine_thread_t::park_until(chroutine_t *co, std::time_t deadline)
+{
+    cancel_sleep(co);
+    // the us wheel is stepped by every us passed, keep it for the short sub-ms ones
+    co->napping = deadline % 1000 != 0 && deadline - mono_clock_t::cached_us() < NAP_MAX_US;
+    if (co->napping) {
+        m_schedule.chroutines_napping.add(&co->timer, deadline);
+    } else {
+        m_schedule.chroutines_sleeping.add(&co->timer, (deadline + 999) / 1000);
+    }
+}
+
+void chroutine_thread_t::cancel_sleep(chroutine_t *co)
+{
+    if (co->napping) {
+        m_schedule.chroutines_napping.cancel(&co->timer);
+    } else {
+        m_schedule.chroutines_sleeping.cancel(&co->timer);
+    }
+}
+
+bool chroutine_thread_t::kick()
+{
+    if (!unpark()) {
+        return false;
+    }
+    uint64_t one = 1;
+    if (m_kick_fd >= 0 && write(m_kick_fd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+        SPDLOG(ERROR, "chroutine_thread_t {:p} kick failed: {}", (void*)this, errno);
+    }
+    return true;
+}
+
+bool chroutine_thread_t::unpark()
+{
+    if (!m_parked.exchange(false)) {
+        return false;
+    }
+    if (m_type == thread_type_t::worker) {
+        engine_t::instance().m_parked_workers.fetch_sub(1);
+    }
+    return true;
+}
+
+void chroutine_thread_t::park()
+{
+    std::time_t timeout = (m_selector_list.empty() ? IDLE_PARK_MAX_MS : SELECT_INTERVAL_MS) * 1000;
+    {
+        std::lock_guard<std::mutex> lock(m_chroutine_lock);
+        if (!m_schedule.chroutines_ready.empty()) {
+            return;
+        }
+        std::time_t now = mono_clock_t::now_us();
+        std::time_t next = next_expire(now + timeout);
+        if (next <= now) {
+            return;
+        }
+        timeout = next - now;
+    }
+
+    // from now on, whoever posts to the inbox kicks
+    m_parked.store(true);
+    if (m_type == thread_type_t::worker) {
+        engine_t::instance().m_parked_workers.fetch_add(1);
+    }
+
+    // the ones posted, or queued on other workers, before we announced didn't kick us
+    if (m_need_stop || !m_inbox.empty() || (m_type == thread_type_t::worker && steal() > 0)) {
+        unpark();
+        return;
+    }
+
+    if (m_kick_fd < 0) {
+        std::time_t max = SELECT_INTERVAL_MS * 1000;
+        std::this_thread::sleep_for(std::chrono::microseconds(timeout < max ? timeout : max));
+    } else {
+        struct pollfd pfd;
+        pfd.fd = m_kick_fd;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        // in us, for the napping ones
+        struct timespec ts;
+        ts.tv_sec = timeout / 1000000;
+        ts.tv_nsec = (timeout % 1000000) * 1000;
+        if (ppoll(&pfd, 1, &ts, nullptr) > 0) {
+            uint64_t count = 0;
+            if (read(m_kick_fd, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+                SPDLOG(ERROR, "chroutine_thread_t {:p} read kick failed: {}", (void*)this, errno);
+            }
+        }
+    }
+    unpark();
+}
+
+bool chroutine_thread_t::wake_idle()
+{
+    return kick();
+}
+
+void chroutine_thread_t::call_thief(size_t queued)
+{
+    if (queued > 1 && m_type == thread_type_t::worker) {
+        engine_t::instance().wake_idle_worker(this);
+    }
+}
+
+size_t chroutine_thread_t::steal()
+{
+    if (m_need_stop || m_retiring || state() != thread_state_t_running) {
+        return 0;
+    }
+    return engine_t::instance().steal_chroutines(this);
+}
+
+size_t chroutine_thread_t::give_away(std::vector<chroutine_ptr_t> & stolen, chroutine_thread_t *thief)
+{
+    std::lock_guard<std::mutex> lock(m_chroutine_lock);
+    size_t ready = m_schedule.chroutines_ready.size();
+    // leave one to run next, unless this thread is busy running another
+    size_t limit = m_schedule.running_id == INVALID_ID ? ready / 2 : (ready + 1) / 2;
+    size_t count = 0;
+
+    // from the lowest class, the higher ones are picked here soon anyway
+    for (int c = PRIORITY_CLASSES - 1; c >= 0 && count < limit; c--) {
+        chroutine_t *co = m_schedule.chroutines_ready.lists[c].back();
+        while (co && count < limit) {
+            chroutine_t *prev = chroutine_list_t::prev(co);
+            // a yielding one is queued before it's switched out
+            if (co->movable() && co->id() != m_schedule.running_id
+                && co->father == INVALID_ID && co->son == INVALID_ID) {
+                m_schedule.chroutines_ready.remove(co);
+                m_schedule.chroutines_owned.remove(co);
+                // awakes go to the thief since now
+                chroutine_table_t::set_owner(co->id(), thief);
+                stolen.push_back(chroutine_ptr_t(co, false));
+                count++;
+            }
+            co = prev;
+        }
+    }
+    update_ready_depth();
+    return count;
+}
+
+void chroutine_thread_t::expire_sleeping(std::time_t now)
+{
+    m_schedule.chroutines_sleeping.advance(now / 1000, [this](chroutine_t *co) {
+        make_ready(co);
+    });
+    m_schedule.chroutines_napping.advance(now, [this](chroutine_t *co) {
+        make_ready(co);
+    });
+}
+
+std::time_t chroutine_thread_t::next_expire(std::time_t limit)
+{
+    std::time_t next = m_schedule.chroutines_sleeping.next_expire(limit / 1000) * 1000;
+    if (next > limit) {
+        next = limit;
+    }
+    return m_schedule.chroutines_napping.next_expire(next);
 }
 
 void chroutine_thread_t::remove_chroutine(chroutine_id_t id)
 {
-    chutex_guard_t lock(m_chroutine_lock);
+    // most picks have no timed out son
+    if (id == INVALID_ID)
+        return;
+
+    preempt_off_t off;
+
+    std::lock_guard<std::mutex> lock(m_chroutine_lock);
     
-    auto iter = m_schedule.chroutines_map.find(id);
-    if (iter == m_schedule.chroutines_map.end()) {
+    chroutine_t *co = find(id);
+    if (co == nullptr) {
         return;
     }
-        
-    m_schedule.chroutines_to_free.push_back(iter->second);
-    m_schedule.chroutines_map.erase(iter);
-
-    auto iter_list = m_schedule.chroutines_sched.begin();
-    for (; iter_list != m_schedule.chroutines_sched.end(); iter_list++) {
-        if ((*iter_list)->id() == id) {
-            iter_list = m_schedule.chroutines_sched.erase(iter_list);
-            m_schedule.sched_iter = iter_list;
-            break;
-        }
+
+    // its frames on the shared stack are garbage now
+    if (co == m_shared_stack_owner) {
+        m_shared_stack_owner = nullptr;
     }
+    if (chroutine_list_t::linked(co)) {
+        m_schedule.chroutines_ready.remove(co);
+    }
+    cancel_sleep(co);
+
+    // freed by the next schedule, it may be the running one
+    m_schedule.chroutines_owned.remove(co);
+    chroutine_table_t::set_owner(id, nullptr);
+    m_schedule.chroutines_to_free.push_back(co);
 }
 
 reporter_base_t * chroutine_thread_t::get_current_reporter()
 {
+    preempt_off_t off;
     chroutine_t *p_c = get_chroutine(m_schedule.running_id);
     if (p_c == nullptr)
         return nullptr;
@@ -162,30 +425,59 @@ reporter_base_t * chroutine_thread_t::get_current_reporter()
 
 void chroutine_thread_t::entry(void *arg)
 {
-    chroutine_thread_t *p_this = static_cast<chroutine_thread_t *>(arg);
-    if (p_this == nullptr)
-        return;
-
-    chroutine_t * p_c = p_this->get_chroutine(p_this->m_schedule.running_id);
-    if (p_c == nullptr)
-        return;
-
+    // the chroutine is kept alive by the map of its thread until removed
+    chroutine_t * p_c = static_cast<chroutine_t *>(arg);
     p_c->state = chroutine_state_running;
-    p_c->func(p_c->arg);
+    ms_preemptible = p_c->preemptible;
+    // cancelled before it ran, nothing to unwind
+    if (!p_c->token.cancelled()) {
+        try {
+            p_c->func(p_c->arg);
+        } catch (const chroutine_cancelled_t & e) {
+            SPDLOG(DEBUG, "chroutine {} ({}) unwound: {}", p_c->id(), p_c->tag ? p_c->tag : "", e.what());
+        }
+    }
+    ms_preemptible = 0;
+
+    // the chroutine may be resettled to another thread during running,
+    // so find the thread again.
+    chroutine_thread_t *p_this = current();
+    if (p_this == nullptr) {
+        SPDLOG(CRITICAL, "chroutine finished in an unknown thread!");
+        abort();
+    }
+
     //p_c->state = chroutine_state_fin;
     p_this->remove_chroutine(p_c->id());
     p_this->m_schedule.running_id = INVALID_ID;
 
-    if (p_c->father != INVALID_ID) {
-        chroutine_t * father = p_this->get_chroutine(p_c->father);
-        if (father != nullptr) {
-            father->son_finished();
+    // a cancelled son was given up by its father, which timed out or is cancelled too
+    if (p_c->father != INVALID_ID && !p_c->token.cancelled()) {
+        chroutine_thread_t *father_thread = nullptr;
+        {
+            std::lock_guard<std::mutex> lock(p_this->m_chroutine_lock);
+            chroutine_t *father = p_this->find(p_c->father);
+            if (father) {
+                father->son_finished();
+                p_this->make_ready(father);
+            } else {
+                father_thread = chroutine_table_t::owner(p_c->father);
+            }
+        }
+        // the father was resettled to another thread
+        if (father_thread && father_thread != p_this) {
+            father_thread->awake_chroutine(p_c->father);
         }
     }
+
+    // never return, the stack will be freed by the schedule
+    context_t dead;
+    context_swap(&dead, &(p_this->m_schedule.main));
 }
 
-chroutine_id_t chroutine_thread_t::create_chroutine(func_t & func, void *arg)
+chroutine_id_t chroutine_thread_t::create_chroutine(task_t & func, void *arg, const chroutine_attr_t & attr)
 {
+    preempt_off_t off;
     if (state() > thread_state_t_running) {
         SPDLOG(ERROR, "cant create_chroutine, thread state is: {}", state());
         return INVALID_ID;
@@ -193,34 +485,62 @@ chroutine_id_t chroutine_thread_t::create_chroutine(func_t & func, void *arg)
     if (func == nullptr) 
         return INVALID_ID;
 
-    chroutine_id_t id = chroutine_thread_t::gen_chroutine_id();
-    std::shared_ptr<chroutine_t> c(new chroutine_t(id));
+    chroutine_ptr_t c(new chroutine_t());
     chroutine_t *p_c = c.get();
-    if (p_c == nullptr)
-        return INVALID_ID;
+    chroutine_id_t id = p_c->id();
 
-    getcontext(p_c->ctx);
-    p_c->ctx->uc_stack.ss_sp = p_c->stack;
-    p_c->ctx->uc_stack.ss_size = STACK_SIZE;
-    p_c->ctx->uc_stack.ss_flags = 0;
-    p_c->ctx->uc_link = &(m_schedule.main);
     p_c->func = std::move(func);
     p_c->arg = arg;
     p_c->state = chroutine_state_ready;
-    makecontext(p_c->ctx,(void (*)(void))(entry), 1, this);
+    p_c->tag = attr.tag;
+    p_c->pinned = attr.pinned;
+    p_c->preemptible = attr.preemptible;
+    if (p_c->preemptible) {
+        install_preempt_handler();
+    }
+    p_c->priority = attr.priority == priority_t::inherit ? priority_t::normal : attr.priority;
+    p_c->token = attr.token;
+    if (p_c->token.valid()) {
+        p_c->token.state()->attach(id, &p_c->token_slot);
+    }
+    if (attr.shared_stack && !context_has_sp()) {
+        SPDLOG(WARN, "shared stack is not supported by context backend {}, use private stack", context_backend());
+    } else if (attr.shared_stack) {
+        // the context is made when it's switched to the shared stack for the first time
+        p_c->shared_stack = true;
+    }
+    if (!p_c->shared_stack) {
+        // only the size for now if it's for another thread, the stack is made by that thread
+        // when it takes the chroutine, so it's from the pool (and the NUMA node) of that thread
+        p_c->stack.size = attr.stack_size > 0 ? attr.stack_size : STACK_CLASS_SIZES[attr.stack_class];
+        if (in_own_thread() && !make_stack(p_c)) {
+            SPDLOG(ERROR, "create_chroutine failed: no memory for stack");
+            return INVALID_ID;
+        }
+    }
 
-    {
-        chutex_guard_t lock(m_chroutine_lock);
-        m_schedule.chroutines_map[id] = c;
-        m_schedule.chroutines_sched.push_back(c);
+    if (in_own_thread()) {
+        size_t queued = 0;
+        {
+            std::lock_guard<std::mutex> lock(m_chroutine_lock);
+            adopt(c);
+            queued = m_schedule.chroutines_ready.size();
+        }
+        call_thief(queued);
+    } else {
+        inbox_msg_t *msg = new inbox_msg_t();
+        msg->op = inbox_spawn;
+        msg->co = c.detach();
+        post(msg);
     }
 
     SPDLOG(TRACE, "create_chroutine {} over, thread type: {}", id, static_cast<int>(m_type));
     return id;
 }
 
-chroutine_id_t chroutine_thread_t::create_son_chroutine(func_t & func, const reporter_sptr_t & reporter)
+chroutine_id_t chroutine_thread_t::create_son_chroutine(task_t & func, const reporter_sptr_t & reporter, const chroutine_attr_t & attr)
 {
+    preempt_off_t off;
     if (state() > thread_state_t_running) {
         SPDLOG(ERROR, "cant create_son_chroutine, thread state is: {}", state());
         return INVALID_ID;
@@ -232,68 +552,62 @@ chroutine_id_t chroutine_thread_t::create_son_chroutine(func_t & func, const rep
     
     pfather->reporter = reporter;
 
-    chroutine_id_t son = create_chroutine(func, reporter.get()->get_data());
+    chroutine_id_t son = create_chroutine(func, reporter.get()->get_data(), pfather->son_attr(attr));
     if (son == INVALID_ID)
         return INVALID_ID;
     
-    chutex_guard_t lock(m_chroutine_lock);
-    chroutine_t * pson = m_schedule.chroutines_map[son].get();
+    chroutine_t * pson = get_chroutine(son);
     if (pson == nullptr)
         return INVALID_ID;
 
+    std::lock_guard<std::mutex> lock(m_chroutine_lock);
+
     pson->father = m_schedule.running_id;
     pfather->son = son;
+    pfather->son_token = pson->token;
     return son;
 }
 
 void chroutine_thread_t::yield_current(int tick)
 {
+    preempt_off_t off;
     if (tick <= 0)
         return;
         
-    if (m_schedule.running_id == INVALID_ID)
+    chroutine_t * co = this == ms_current ? ms_running : nullptr;
+    if (co == nullptr || co->state != chroutine_state_running)
         return;
-
-    chroutine_t * co = nullptr;
-    {        
-        chutex_guard_t lock(m_chroutine_lock);        
-        co = m_schedule.chroutines_map[m_schedule.running_id].get();
-        if (co == nullptr || co->state != chroutine_state_running)
-            return;
-    }
         
-    co->state = chroutine_state_suspend;
-    co->yield_wait += tick;
-    m_schedule.running_id = INVALID_ID;
-    swapcontext(co->ctx, &(m_schedule.main));
+    {
+        std::lock_guard<std::mutex> lock(m_chroutine_lock);
+        // back to the tail, and skip (tick-1) more rounds
+        co->state = chroutine_state_suspend;
+        co->yield_wait += tick - 1;
+        m_schedule.chroutines_ready.push_back(co);
+    }
+    context_swap(&co->ctx, &(m_schedule.main));
 }
 
-void chroutine_thread_t::wait_current(std::time_t wait_time_ms, bool stop_son_after_wait)
+void chroutine_thread_t::wait_current(std::time_t deadline, bool stop_son_after_wait)
 {
-    if (wait_time_ms <= 0)
-        return;
-
-    if (m_schedule.running_id == INVALID_ID)
+    preempt_off_t off;
+    chroutine_t * co = this == ms_current ? ms_running : nullptr;
+    if (co == nullptr || co->state != chroutine_state_running)
         return;
-
-    chroutine_t * co = nullptr;
+    
     {
-        chutex_guard_t lock(m_chroutine_lock);        
-        co = m_schedule.chroutines_map[m_schedule.running_id].get();
-        if (co == nullptr || co->state != chroutine_state_running)
-            return;
+        std::lock_guard<std::mutex> lock(m_chroutine_lock);
+        co->state = chroutine_state_suspend;
+        co->yield_to = clamp_deadline(co, deadline);
+        co->stop_son_when_yield_over = stop_son_after_wait;
+        park_until(co, co->yield_to);
     }
-    
-    co->state = chroutine_state_suspend;
-    co->yield_to = get_time_stamp() + wait_time_ms;
-    co->stop_son_when_yield_over = stop_son_after_wait;
-    m_schedule.running_id = INVALID_ID;
-    swapcontext(co->ctx, &(m_schedule.main));
+    context_swap(&co->ctx, &(m_schedule.main));
 }
 
 bool chroutine_thread_t::done()
 {
-    return m_schedule.chroutines_map.empty();
+    return m_schedule.chroutines_owned.empty();
 }
 
 void chroutine_thread_t::resume_to(chroutine_id_t id)
@@ -302,7 +616,7 @@ void chroutine_thread_t::resume_to(chroutine_id_t id)
     if (co == nullptr || co->state != chroutine_state_suspend)
         return;
     
-    swapcontext(&(m_schedule.main), co->ctx);
+    context_swap(&(m_schedule.main), &co->ctx);
 }
 
 int chroutine_thread_t::pick_run_chroutine()
@@ -310,43 +624,70 @@ int chroutine_thread_t::pick_run_chroutine()
     if (m_schedule.running_id != INVALID_ID)
         return 1;
 
-    chroutine_list_t::iterator sched_iter = m_schedule.chroutines_sched.end();
     chroutine_t *p_c = nullptr;
     int pick_count = 0;
-    std::time_t now = get_time_stamp();
+    std::time_t now = mono_clock_t::now_us();
+    chroutine_list_t to_free;
 
     {
-        chutex_guard_t lock(m_chroutine_lock);
-        // clean finished tasks
-        m_schedule.chroutines_to_free.clear();
-        if (m_schedule.chroutines_sched.empty())
-            return pick_count;
-
-        if (m_schedule.sched_iter == m_schedule.chroutines_sched.end()) {
-            m_schedule.sched_iter = m_schedule.chroutines_sched.begin();
-        }
-
-        for (; m_schedule.sched_iter != m_schedule.chroutines_sched.end(); m_schedule.sched_iter++) {
-            auto &node = *(m_schedule.sched_iter);
-            if (node->has_moved() || node->wait(now) > 0)
-                continue;
-            if (p_c == nullptr) {
-                p_c = node.get();
-                sched_iter = m_schedule.sched_iter;
-                sched_iter++;
-                pick_count++;
-            }
+        std::lock_guard<std::mutex> lock(m_chroutine_lock);
+        std::swap(to_free, m_schedule.chroutines_to_free);
+        expire_sleeping(now);
+
+        p_c = m_schedule.chroutines_ready.pick();
+        if (p_c) {
+            pick_count++;
+        }
+
+        // set before unlocking, so it won't be resettled by move_chroutines_to_thread
+        if (p_c) {
+            m_schedule.running_id = p_c->id();
         }
+        update_ready_depth();
+    }
+
+    // clean finished tasks, out of the lock as their destructors may run anything
+    if (!to_free.empty()) {
+        while (!to_free.empty()) {
+            chroutine_ptr_t(to_free.pop_front(), false);
+        }
+        // the entry time is the cached one
+        mono_clock_t::now_us();
     }
 
-    m_schedule.sched_iter = sched_iter;
     if (p_c) {
-        remove_chroutine(p_c->yield_over());  // remove time out son chroutin
+        p_c->yield_over().cancel();  // cancel time out son chroutin
+        if (p_c->use_shared_stack()) {
+            switch_shared_stack(p_c);
+        }
         p_c->state = chroutine_state_running;
-        m_schedule.running_id = p_c->id();
         set_entry_time();
-        swapcontext(&(m_schedule.main), p_c->ctx);
+        m_running_preemptible.store(p_c->preemptible, std::memory_order_relaxed);
+        ms_running = p_c;
+        context_swap(&(m_schedule.main), &p_c->ctx);
+        ms_running = nullptr;
+        m_running_preemptible.store(false, std::memory_order_relaxed);
+
+        // only the ones flagged by check_slice may have overrun, don't read the clock for others
+        std::time_t ran = 0;
+        if (m_preempt_pending.load(std::memory_order_relaxed)) {
+            m_preempt_pending.store(false, std::memory_order_relaxed);
+            ran = mono_clock_t::now_ms() - entry_time();
+        }
         clear_entry_time();
+        if (ran >= MAX_RUN_MS_EACH) {
+            p_c->overruns++;
+            m_overruns.fetch_add(1, std::memory_order_relaxed);
+            // the 1st, 2nd, 4th... time, a preemptible one overruns every slice
+            if ((p_c->overruns & (p_c->overruns - 1)) == 0) {
+                SPDLOG(WARN, "chroutine {} ({}) ran {} ms without switching out, overruns {}"
+                    , p_c->id(), p_c->tag ? p_c->tag : "", ran, p_c->overruns);
+            }
+        }
+
+        // it was queued or parked, and can be resettled since now
+        std::lock_guard<std::mutex> lock(m_chroutine_lock);
+        m_schedule.running_id = INVALID_ID;
     }
     return pick_count;
 }
@@ -359,6 +700,14 @@ void chroutine_thread_t::update_thread_id()
 int chroutine_thread_t::schedule()
 {
     update_thread_id();
+    m_native_thread = pthread_self();
+    // before anything is allocated, so the stacks and slabs are on the local node
+    if (!m_cpus.empty() && cpu_topology_t::pin(m_native_thread, m_cpus)) {
+        m_node = cpu_topology_t::node_of_cpus(m_cpus);
+        SPDLOG(INFO, "chroutine_thread_t {:p} pinned to {} cpus, node {}", (void*)this, m_cpus.size(), node());
+    }
+    ms_current = this;
+    mono_clock_t::set_scheduler();
     set_state(thread_state_t_running);
     m_is_running = true;
     SPDLOG(INFO, "chroutine_thread_t {:p} schedule is_running {}, m_type:{} ({})", (void*)(this)
@@ -367,19 +716,33 @@ int chroutine_thread_t::schedule()
         , readable_thread_id(m_std_thread_id));
 
     if (m_type == thread_type_t::worker) {
-        engine_t::instance().on_thread_ready(m_creating_index, m_std_thread_id);
+        engine_t::instance().on_thread_ready(this);
     }
     while (!m_need_stop) {        
+        if (m_retiring && hand_over()) {
+            break;
+        }
         int processed = 0;
+        processed += drain_inbox();
         processed += select_all();
         processed += pick_run_chroutine();
         m_load.update(processed);
-        if (processed == 0)
-            thread_ms_sleep(10);
+        if (processed == 0 && m_type == thread_type_t::worker) {
+            processed += steal();
+        }
+        if (processed > 0) {
+            m_idle_rounds = 0;
+        } else if (++m_idle_rounds <= IDLE_SPIN_ROUNDS) {
+            std::this_thread::yield();
+        } else {
+            stack_pool_t::trim();
+            park();
+        }
     }
     m_is_running = false;
     set_state(thread_state_t_finished);
     clear_all_chroutine();
+    ms_current = nullptr;
 
     SPDLOG(INFO, "chroutine_thread_t {:p} schedule is_running {}, m_type:{} ({})"
         , (void*)(this)
@@ -389,12 +752,11 @@ int chroutine_thread_t::schedule()
     return 0;
 }
 
-void chroutine_thread_t::start(size_t creating_index)
+void chroutine_thread_t::start()
 {
     if (m_is_running)
         return;
 
-    m_creating_index = creating_index;
     std::thread thrd( [this] { this->schedule(); } );
     thrd.detach();
 }
@@ -402,6 +764,7 @@ void chroutine_thread_t::start(size_t creating_index)
 void chroutine_thread_t::stop()
 {
     m_need_stop = true;
+    kick();
     SPDLOG(INFO, "chroutine_thread_t {:p} exiting...", (void*)this);
 }
 
@@ -419,11 +782,21 @@ int chroutine_thread_t::select_all()
 
 void chroutine_thread_t::register_selector(const selectable_object_sptr_t & select_obj)
 {
+    preempt_off_t off;
     void *key = select_obj.get();
     if (key) {
         auto iter = m_selector_list.find(key);
         if (iter == m_selector_list.end()) {
             m_selector_list[key] = select_obj;
+            m_selectors = m_selector_list.size();
+            // it may be registered by another thread, don't park longer than the select interval
+            kick();
+            // the chroutine registering it is awaken by it here, so keep it on this thread
+            std::lock_guard<std::mutex> lock(m_chroutine_lock);
+            chroutine_t *running = find(m_schedule.running_id);
+            if (running && in_own_thread()) {
+                running->pinned = true;
+            }
         } else {
         }
     }
@@ -436,12 +809,14 @@ void chroutine_thread_t::unregister_selector(const selectable_object_sptr_t & se
 
 void chroutine_thread_t::unregister_selector(selectable_object_it *p_obj)
 {
+    preempt_off_t off;
     void *key = p_obj;
     auto iter = m_selector_list.find(key);
     if (iter == m_selector_list.end()) {
         SPDLOG(ERROR, "{} failed: key not exist: {}", __FUNCTION__, key);
     } else {
         m_selector_list.erase(iter);
+        m_selectors = m_selector_list.size();
         SPDLOG(DEBUG, "{} OK: key = {}", __FUNCTION__, key);
     }
 }
@@ -449,16 +824,323 @@ void chroutine_thread_t::unregister_selector(selectable_object_it *p_obj)
 
 int chroutine_thread_t::awake_chroutine(chroutine_id_t id)
 {
-    chroutine_t * p_c = get_chroutine(id);
+    preempt_off_t off;
+    if (!in_own_thread()) {
+        inbox_msg_t *msg = new inbox_msg_t();
+        msg->op = inbox_awake;
+        msg->id = id;
+        post(msg);
+        return 0;
+    }
+
+    cancel_token_t timeout_son;
+    size_t queued = 0;
+    {
+        std::unique_lock<std::mutex> lock(m_chroutine_lock);
+        if (!awake(id, timeout_son)) {
+            lock.unlock();
+            return forward_awake(id);
+        }
+        queued = m_schedule.chroutines_ready.size();
+    }
+
+    call_thief(queued);
+    timeout_son.cancel();
+    return 0;
+}
+
+bool chroutine_thread_t::unpark(chroutine_id_t id)
+{
+    chroutine_t * p_c = find(id);
+    if (p_c == nullptr) {
+        return false;
+    }
+
+    if (p_c->parking) {
+        p_c->unparked = true;
+        make_ready(p_c);
+    } else {
+        p_c->permit = true;
+    }
+    return true;
+}
+
+int chroutine_thread_t::unpark_chroutine(chroutine_id_t id)
+{
+    preempt_off_t off;
+    if (!in_own_thread()) {
+        inbox_msg_t *msg = new inbox_msg_t();
+        msg->op = inbox_unpark;
+        msg->id = id;
+        post(msg);
+        return 0;
+    }
+
+    size_t queued = 0;
+    {
+        std::unique_lock<std::mutex> lock(m_chroutine_lock);
+        if (!unpark(id)) {
+            lock.unlock();
+            return forward_awake(id, inbox_unpark);
+        }
+        queued = m_schedule.chroutines_ready.size();
+    }
+
+    call_thief(queued);
+    return 0;
+}
+
+bool chroutine_thread_t::park_current(std::time_t deadline)
+{
+    preempt_off_t off;
+    chroutine_t * co = this == ms_current ? ms_running : nullptr;
+    if (co == nullptr || co->state != chroutine_state_running)
+        return false;
+
+    {
+        std::lock_guard<std::mutex> lock(m_chroutine_lock);
+        if (co->permit) {
+            co->permit = false;
+            return true;
+        }
+        co->state = chroutine_state_suspend;
+        co->parking = true;
+        co->unparked = false;
+        deadline = clamp_deadline(co, deadline);
+        if (deadline != 0) {
+            co->yield_to = deadline;
+            park_until(co, deadline);
+        }
+    }
+    context_swap(&co->ctx, &(m_schedule.main));
+
+    // it may run on another thread now
+    chroutine_thread_t *thrd = current();
+    std::lock_guard<std::mutex> lock(thrd->m_chroutine_lock);
+    bool unparked = co->unparked;
+    co->unparked = false;
+    return unparked;
+}
+
+void chroutine_thread_t::awake_chroutines(const chroutine_id_t *ids, size_t count)
+{
+    preempt_off_t off;
+    if (in_own_thread()) {
+        for (size_t i = 0; i < count; i++) {
+            awake_chroutine(ids[i]);
+        }
+        return;
+    }
+
+    inbox_msg_t *first = nullptr;
+    inbox_msg_t **link = &first;
+    for (size_t i = 0; i < count; i++) {
+        inbox_msg_t *msg = new inbox_msg_t();
+        msg->op = inbox_awake;
+        msg->id = ids[i];
+        *link = msg;
+        link = &msg->next;
+    }
+    if (first) {
+        post(first);
+    }
+}
+
+int chroutine_thread_t::interrupt_chroutine(chroutine_id_t id)
+{
+    preempt_off_t off;
+    if (!in_own_thread()) {
+        inbox_msg_t *msg = new inbox_msg_t();
+        msg->op = inbox_interrupt;
+        msg->id = id;
+        post(msg);
+        return 0;
+    }
+
+    size_t queued = 0;
+    {
+        std::unique_lock<std::mutex> lock(m_chroutine_lock);
+        if (!interrupt(id)) {
+            lock.unlock();
+            return forward_awake(id, inbox_interrupt);
+        }
+        queued = m_schedule.chroutines_ready.size();
+    }
+
+    call_thief(queued);
+    return 0;
+}
+
+bool chroutine_thread_t::interrupt(chroutine_id_t id)
+{
+    chroutine_t * p_c = find(id);
     if (p_c == nullptr) {
-        SPDLOG(ERROR, "{} p_c == nullptr ! id = {}", __FUNCTION__, id);
+        return false;
+    }
+
+    // a ready or running one sees it at its next suspension point
+    if (p_c->state == chroutine_state_suspend && !chroutine_list_t::linked(p_c)
+            && m_schedule.running_id != id) {
+        make_ready(p_c);
+    }
+    return true;
+}
+
+std::time_t chroutine_thread_t::clamp_deadline(const chroutine_t *co, std::time_t deadline)
+{
+    std::time_t limit = co->token.deadline_us();
+    if (limit != 0 && (deadline == 0 || limit < deadline)) {
+        return limit;
+    }
+    return deadline;
+}
+
+bool chroutine_thread_t::awake(chroutine_id_t id, cancel_token_t & timeout_son)
+{
+    chroutine_t * p_c = find(id);
+    if (p_c == nullptr) {
+        return false;
+    }
+
+    timeout_son = p_c->yield_over(result_done);
+    make_ready(p_c);
+    return true;
+}
+
+int chroutine_thread_t::forward_awake(chroutine_id_t id, inbox_op_t op)
+{
+    chroutine_thread_t *owner = chroutine_table_t::owner(id);
+    if (owner == nullptr) {
+        // a cancelled one may have finished just now
+        if (op != inbox_interrupt) {
+            SPDLOG(ERROR, "{} p_c == nullptr ! id = {}", __FUNCTION__, id);
+        }
         return -1;
     }
 
-    remove_chroutine(p_c->yield_over(result_done));
+    // it was resettled or stolen, or its adopting is still in our inbox: try again there
+    inbox_msg_t *msg = new inbox_msg_t();
+    msg->op = op;
+    msg->id = id;
+    owner->post(msg);
     return 0;
 }
 
+void chroutine_thread_t::adopt(const chroutine_ptr_t &chroutine)
+{
+    chroutine_t *p_c = chroutine.get();
+    if (!chroutine_owned_list_t::linked(p_c)) {
+        m_schedule.chroutines_owned.push_back(chroutine_ptr_t(chroutine).detach());
+    }
+    chroutine_table_t::set_owner(p_c->id(), this);
+    if (p_c->yield_to != 0) {
+        park_until(p_c, p_c->yield_to);
+    } else if (!p_c->parking) {
+        make_ready(p_c);
+    }
+}
+
+void chroutine_thread_t::post(inbox_msg_t *first)
+{
+    m_inbox.post(first);
+    kick();
+}
+
+int chroutine_thread_t::drain_inbox()
+{
+    inbox_msg_t *msg = m_inbox.take();
+    if (msg == nullptr) {
+        return 0;
+    }
+
+    // the stacks of the new ones, out of the lock
+    for (inbox_msg_t *spawn = msg; spawn; spawn = spawn->next) {
+        chroutine_t *co = spawn->co;
+        if (spawn->op == inbox_spawn && co && !co->shared_stack && co->stack.empty() && !make_stack(co)) {
+            SPDLOG(ERROR, "chroutine({}) dropped: no memory for stack", co->id());
+            chroutine_ptr_t(co, false);
+            spawn->co = nullptr;
+        }
+    }
+
+    int count = 0;
+    size_t queued = 0;
+    std::vector<cancel_token_t> timeout_sons;
+    std::vector<chroutine_id_t> missed;
+    std::vector<chroutine_id_t> missed_unparks;
+    std::vector<chroutine_id_t> missed_interrupts;
+    {
+        std::lock_guard<std::mutex> lock(m_chroutine_lock);
+        while (msg) {
+            inbox_msg_t *next = msg->next;
+            if (msg->op == inbox_awake) {
+                cancel_token_t timeout_son;
+                if (!awake(msg->id, timeout_son)) {
+                    missed.push_back(msg->id);
+                } else if (timeout_son.valid()) {
+                    timeout_sons.push_back(timeout_son);
+                }
+            } else if (msg->op == inbox_unpark) {
+                if (!unpark(msg->id)) {
+                    missed_unparks.push_back(msg->id);
+                }
+            } else if (msg->op == inbox_interrupt) {
+                if (!interrupt(msg->id)) {
+                    missed_interrupts.push_back(msg->id);
+                }
+            } else if (msg->co) {
+                adopt(chroutine_ptr_t(msg->co, false));
+            }
+            delete msg;
+            msg = next;
+            count++;
+        }
+        queued = m_schedule.chroutines_ready.size();
+    }
+
+    for (auto &son : timeout_sons) {
+        son.cancel();
+    }
+    for (auto id : missed) {
+        forward_awake(id);
+    }
+    for (auto id : missed_unparks) {
+        forward_awake(id, inbox_unpark);
+    }
+    for (auto id : missed_interrupts) {
+        forward_awake(id, inbox_interrupt);
+    }
+    call_thief(queued);
+    return count;
+}
+
+bool chroutine_thread_t::make_stack(chroutine_t *co)
+{
+    co->stack = stack_pool_t::acquire(co->stack.size);
+    if (co->stack.empty()) {
+        return false;
+    }
+    if (stack_pool_t::painting()) {
+        stack_pool_t::paint(co->stack);
+        co->painted = true;
+    }
+    context_make(&co->ctx, co->stack.base, co->stack.size, entry, co);
+    return true;
+}
+
+void chroutine_thread_t::drop_inbox()
+{
+    inbox_msg_t *msg = m_inbox.take();
+    while (msg) {
+        inbox_msg_t *next = msg->next;
+        if (msg->co) {
+            chroutine_ptr_t(msg->co, false);
+        }
+        delete msg;
+        msg = next;
+    }
+}
+
 void chroutine_thread_t::set_state(thread_state_t state) 
 {
     SPDLOG(INFO, "chroutine_thread_t {:p} state change {}->{}", (void*)this, this->state(), state);
@@ -470,58 +1152,259 @@ thread_state_t chroutine_thread_t::state()
     return m_state.load(std::memory_order_relaxed);
 }
 
-void chroutine_thread_t::move_chroutines_to_thread(const std::shared_ptr<chroutine_thread_t> & other_thread)
+size_t chroutine_thread_t::move_chroutines_to_thread(const std::vector<chroutine_thread_t *> & others)
 {
-    if (other_thread.get() == this) {
-        return;
+    set_state(thread_state_t_shifting);
+    size_t moved = hand_out(others);
+    set_state(thread_state_t_blocking);
+    return moved;
+}
+
+size_t chroutine_thread_t::hand_out(const std::vector<chroutine_thread_t *> & others)
+{
+    // each one goes to the least loaded, counting the ones given already
+    std::vector<float> pressures;
+    for (auto other : others) {
+        pressures.push_back(other == this ? -1 : other->pressure());
     }
 
-    set_state(thread_state_t_shifting);
-    std::vector<chroutine_id_t> ids_to_move;
-    
+    std::vector<chroutine_ptr_t> to_move;
+    std::vector<chroutine_thread_t *> targets;
     {
-        chutex_guard_t lock(m_chroutine_lock);
-        auto iter_list = m_schedule.chroutines_sched.begin();
-        for (; iter_list != m_schedule.chroutines_sched.end(); iter_list++) {
-            if ((*iter_list)->id() != m_schedule.running_id) {
-                chroutine_id_t resettled_id = other_thread->resettle(*(iter_list->get()));
-                if ((*iter_list)->id() == resettled_id) {
-                    (*iter_list)->set_moved();
-                    ids_to_move.push_back((*iter_list)->id());
+        // unlink them here first, the chroutine objects are adopted by the other threads
+        std::lock_guard<std::mutex> lock(m_chroutine_lock);
+        chroutine_t *co = m_schedule.chroutines_owned.front();
+        while (co) {
+            chroutine_t *next = chroutine_owned_list_t::next(co);
+            // frames on the shared stack can't be moved to another address
+            if (co->movable() && co->id() != m_schedule.running_id) {
+                size_t least = others.size();
+                for (size_t i = 0; i < others.size(); i++) {
+                    if (pressures[i] >= 0 && (least == others.size() || pressures[i] < pressures[least])) {
+                        least = i;
+                    }
+                }
+                if (least == others.size()) {
+                    break;
+                }
+                pressures[least] += 1;
+
+                if (chroutine_list_t::linked(co)) {
+                    m_schedule.chroutines_ready.remove(co);
                 }
-                SPDLOG(INFO, "chroutine({}) of thread:{:p} move_chroutines_to_thread {:p} with resettled_id {}"
-                        , (*iter_list)->id()
-                        , (void*)(this)
-                        , (void*)(other_thread.get())
-                        , resettled_id);
+                cancel_sleep(co);
+                m_schedule.chroutines_owned.remove(co);
+                // awakes go to the other thread since now
+                chroutine_table_t::set_owner(co->id(), others[least]);
+                to_move.push_back(chroutine_ptr_t(co, false));
+                targets.push_back(others[least]);
             }
+            co = next;
         }
+        update_ready_depth();
     }
 
-    for (auto &i : ids_to_move) {
-        remove_chroutine(i);
+    for (size_t i = 0; i < to_move.size(); i++) {
+        chroutine_id_t resettled_id = targets[i]->resettle(to_move[i]);
+        SPDLOG(INFO, "chroutine({}) of thread:{:p} move_chroutines_to_thread {:p} with resettled_id {}"
+                , to_move[i]->id()
+                , (void*)(this)
+                , (void*)(targets[i])
+                , resettled_id);
     }
+    return to_move.size();
+}
 
-    set_state(thread_state_t_blocking);
+chroutine_id_t chroutine_thread_t::blocker(std::string & tag)
+{
+    std::lock_guard<std::mutex> lock(m_chroutine_lock);
+    chroutine_t *co = find(m_schedule.running_id);
+    if (co == nullptr) {
+        return INVALID_ID;
+    }
+    tag = co->tag ? co->tag : "";
+    return co->id();
 }
 
-chroutine_id_t chroutine_thread_t::resettle(chroutine_t &chroutine)
+void chroutine_thread_t::retire()
 {
-    std::shared_ptr<chroutine_t> c(new chroutine_t(std::move(chroutine)));
-    chroutine_t *p_c = c.get();
+    m_retiring = true;
+    kick();
+    SPDLOG(INFO, "chroutine_thread_t {:p} retiring...", (void*)this);
+}
+
+bool chroutine_thread_t::retirable(size_t own_selectors)
+{
+    if (m_selectors.load() > own_selectors) {
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(m_chroutine_lock);
+    for (chroutine_t *co = m_schedule.chroutines_owned.front(); co; co = chroutine_owned_list_t::next(co)) {
+        if (!co->movable()) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool chroutine_thread_t::hand_over()
+{
+    std::time_t now = mono_clock_t::now_ms();
+    if (m_retire_since == 0) {
+        m_retire_since = now;
+    }
+
+    // the inbox first, the ones posted here before unpublishing go out with the others
+    drain_inbox();
+    std::vector<chroutine_thread_t *> others = engine_t::instance().healthy_workers();
+    if (!others.empty()) {
+        hand_out(others);
+    }
+
+    // the unmovable ones (created after it was found retirable) finish here.
+    // and wait a little for the awakes still routed here, they are forwarded since now.
+    {
+        std::lock_guard<std::mutex> lock(m_chroutine_lock);
+        if (!m_schedule.chroutines_owned.empty()) {
+            return false;
+        }
+    }
+    return m_inbox.empty() && now - m_retire_since > RETIRE_GRACE_MS;
+}
+
+chroutine_id_t chroutine_thread_t::resettle(const chroutine_ptr_t &chroutine)
+{
+    preempt_off_t off;
+    chroutine_t *p_c = chroutine.get();
     if (p_c == nullptr)
         return INVALID_ID;
-        
-    p_c->ctx->uc_link = &(m_schedule.main);
-    {
-        chutex_guard_t lock(m_chroutine_lock);
-        m_schedule.chroutines_map[p_c->id()] = c;
-        m_schedule.chroutines_sched.push_back(c);
+
+    if (in_own_thread()) {
+        std::lock_guard<std::mutex> lock(m_chroutine_lock);
+        adopt(chroutine);
+    } else {
+        inbox_msg_t *msg = new inbox_msg_t();
+        msg->op = inbox_adopt;
+        msg->co = chroutine_ptr_t(chroutine).detach();
+        post(msg);
     }
 
     return p_c->id();
 }
 
+void chroutine_thread_t::save_shared_stack(chroutine_t *co)
+{
+    char *top = m_shared_stack.top();
+    char *sp = static_cast<char *>(context_sp(&co->ctx));
+    size_t used = top - sp;
+    if (co->save_cap < used || co->save_cap > used * 2) {
+        delete [] co->save_buf;
+        co->save_buf = new char[used];
+        co->save_cap = used;
+    }
+    memcpy(co->save_buf, sp, used);
+    co->save_size = used;
+}
+
+void chroutine_thread_t::restore_shared_stack(chroutine_t *co)
+{
+    char *top = m_shared_stack.top();
+    memcpy(top - co->save_size, co->save_buf, co->save_size);
+}
+
+void chroutine_thread_t::switch_shared_stack(chroutine_t *co)
+{
+    if (m_shared_stack.empty()) {
+        m_shared_stack = stack_pool_t::acquire(SHARED_STACK_SIZE);
+        if (m_shared_stack.empty()) {
+            SPDLOG(CRITICAL, "no memory for the shared stack!");
+            abort();
+        }
+    }
+
+    if (m_shared_stack_owner == co) {
+        return;
+    }
+
+    // the frames of the owner stay on the stack until someone else needs it
+    if (m_shared_stack_owner != nullptr) {
+        save_shared_stack(m_shared_stack_owner);
+    }
+
+    if (co->state == chroutine_state_ready) {
+        context_make(&co->ctx, m_shared_stack.base, m_shared_stack.size, entry, co);
+    } else {
+        restore_shared_stack(co);
+    }
+    m_shared_stack_owner = co;
+}
+
+void chroutine_thread_t::check_slice(std::time_t now)
+{
+    std::time_t entry = entry_time();
+    if (entry == 0 || now - entry < MAX_RUN_MS_EACH) {
+        return;
+    }
+
+    m_preempt_pending.store(true, std::memory_order_relaxed);
+    // once per slice, as the signal breaks the syscall it's blocked in (EINTR)
+    if (m_running_preemptible.load(std::memory_order_relaxed) && entry != m_preempt_signaled) {
+        m_preempt_signaled = entry;
+        pthread_kill(m_native_thread, PREEMPT_SIGNAL);
+    }
+}
+
+int chroutine_thread_t::get_overruns(chroutine_id_t id)
+{
+    chroutine_t *co = get_chroutine(id);
+    if (co == nullptr) {
+        return -1;
+    }
+    return co->overruns;
+}
+
+void chroutine_thread_t::install_preempt_handler()
+{
+    static std::once_flag installed;
+    std::call_once(installed, [] {
+        struct sigaction act;
+        memset(&act, 0, sizeof(act));
+        act.sa_handler = on_preempt_signal;
+        sigemptyset(&act.sa_mask);
+        // the handler may switch out and never return for a while, so don't block the signal in it
+        act.sa_flags = SA_RESTART | SA_NODEFER;
+        if (sigaction(PREEMPT_SIGNAL, &act, nullptr) != 0) {
+            SPDLOG(ERROR, "install the handler of signal {} failed: {}", PREEMPT_SIGNAL, errno);
+        }
+    });
+}
+
+void chroutine_thread_t::on_preempt_signal(int signo)
+{
+    chroutine_thread_t *thrd = ms_current;
+    if (thrd == nullptr || !ms_preemptible) {
+        return;
+    }
+    int saved_errno = errno;
+    thrd->preempt_running();
+    errno = saved_errno;
+}
+
+void chroutine_thread_t::preempt_running()
+{
+    // the lock is taken if it was interrupted inside the schedule
+    chroutine_t *co = ms_running;
+    if (co == nullptr || co->state != chroutine_state_running || !m_chroutine_lock.try_lock()) {
+        return;
+    }
+
+    preempt_off_t off;
+    co->state = chroutine_state_suspend;
+    m_schedule.chroutines_ready.push_back(co);
+    m_chroutine_lock.unlock();
+    context_swap(&co->ctx, &(m_schedule.main));
+}
+
 std::time_t chroutine_thread_t::entry_time() 
 {
     return m_entry_time.load(std::memory_order_relaxed);
@@ -529,7 +1412,8 @@ std::time_t chroutine_thread_t::entry_time()
 
 void chroutine_thread_t::set_entry_time() 
 {
-    m_entry_time.store(get_time_stamp(),std::memory_order_relaxed);
+    // read by pick_run_chroutine just now
+    m_entry_time.store(mono_clock_t::cached_ms(),std::memory_order_relaxed);
 }
 
 void chroutine_thread_t::clear_entry_time() 
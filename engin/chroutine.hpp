@@ -11,25 +11,49 @@
 #ifndef CHROUTINE_H
 #define CHROUTINE_H
 
-#include <ucontext.h>
 #include <mutex>
+#include <thread>
+#include <signal.h>
+#include <pthread.h>
 #include <memory>
 #include <list>
+#include <atomic>
+#include <vector>
 #include <string.h>
 #include <iostream>
 #include <functional>
-#include <unordered_map>
+#include "context.hpp"
+#include "stack_pool.hpp"
 #include "reporter.hpp"
 #include "selectable_obj.hpp"
 #include "logger.hpp"
 #include "chutex.hpp"
+#include "slab.hpp"
+#include "intrusive.hpp"
+#include "task.hpp"
+#include "timing_wheel.hpp"
+#include "inbox.hpp"
+#include "handle_table.hpp"
+#include "tools.hpp"
+#include "mono_clock.hpp"
+#include "cpu_topology.hpp"
+#include "cancel.hpp"
 
 namespace chr {
 
 const unsigned int STACK_SIZE = 1024*128;
+const unsigned int SHARED_STACK_SIZE = STACK_SIZE*8;
 const int64_t INVALID_ID = -1;
-const int MAX_RUN_MS_EACH = 10;
-
+const int MAX_RUN_MS_EACH = 10;        // time slice of a chroutine, see chroutine_attr_t::preemptible
+const int PREEMPT_SIGNAL = SIGURG;      // sent to switch a preemptible chroutine out of an overrun slice
+const int IDLE_SPIN_ROUNDS = 16;    // idle passes (yielding the cpu) before the thread parks
+const int IDLE_PARK_MAX_MS = 1000;  // max time a thread parks
+const int SELECT_INTERVAL_MS = 10;  // max time a thread parks when it has selectors to poll
+const std::time_t NAP_MAX_US = 16000;   // sub-ms deadlines nearer than this are kept in us, see park_until
+const int RETIRE_GRACE_MS = 100;    // a retiring thread lingers so, for the awakes on the way to it
+const int STARVE_PICKS = 8;         // a waiting priority class is served at least once per this many picks of higher ones
+
+// still accepted for compatibility, any callable taking `void *` or nothing will do.
 typedef std::function<void(void *)> func_t;
 
 typedef enum {
@@ -41,22 +65,111 @@ typedef enum {
 
 } chroutine_state_t;
 
+// where ENGIN.create_chroutine puts a new chroutine
+enum class placement_t {
+    two_choices = 0,    // the less loaded of two random workers
+    local,              // the worker calling, or two_choices if not called in a worker
+    least_loaded,       // the least loaded of all workers
+    thread,             // the thread of chroutine_attr_t::thread_id, or two_choices if not found
+};
+
+// scheduling class of a chroutine, each class has its own ready queue.
+// a higher class runs first, see ready_queue_t for how lower ones are kept from starving.
+enum class priority_t {
+    critical = 0,   // latency critical, e.g. request handlers
+    normal,
+    batch,          // background work, e.g. compaction, log shipping
+    inherit,        // the class of the father for sons, normal for others
+};
+const int PRIORITY_CLASSES = 3;
+
+// options of a chroutine, given when creating
+typedef struct chroutine_attr_t {
+    // run on the shared stack of the thread instead of a private one.
+    // when another shared-stack chroutine needs the stack, the used part is copied
+    // into a right-sized save buffer, and copied back when switched in again.
+    // so it saves a lot of memory for large amount of idle chroutines, but:
+    // - addresses of its stack variables are invalid for others while it's switched out
+    //   (e.g. don't block on reading a channel into a local variable)
+    // - it won't be resettled to other threads if its thread was blocked
+    bool    shared_stack = false;
+
+    // keep it on the creating thread: idle workers won't steal it,
+    // and it won't be resettled to other threads if its thread was blocked.
+    // e.g. it keeps thread local data across yields.
+    // a chroutine registering selectors (timers, rpc clients) to its thread is pinned then.
+    bool    pinned = false;
+
+    // a chroutine running over MAX_RUN_MS_EACH is asked to switch out at its next PREEMPT_POINT().
+    // a preemptible one is also switched out by PREEMPT_SIGNAL wherever it is,
+    // so only set it for computing loops which don't lock, allocate or log
+    // between their calls to the engine, and don't mind EINTR from syscalls.
+    // it's kept on the creating thread like a pinned one: switched out inside the
+    // signal handler, it must return from the handler on the thread that took the signal.
+    bool    preemptible = false;
+
+    // size class of the private stack
+    stack_class_t   stack_class = stack_class_128k;
+
+    // size of the private stack, overrides `stack_class` if not 0.
+    // small sizes are rounded up to the nearest class.
+    size_t  stack_size = 0;
+
+    // stack usage is aggregated by tag when stack painting is on (see stack_pool_t).
+    // e.g. the creation site, must be a string literal or live forever.
+    const char *    tag = nullptr;
+
+    // sons take the class of the father unless it's set
+    priority_t      priority = priority_t::inherit;
+
+    // ignored by create_son_chroutine, sons run on the thread of the father
+    placement_t     placement = placement_t::two_choices;
+    std::thread::id thread_id;  // for placement_t::thread
+
+    // cancelling it cancels the chroutine, see cancel.hpp.
+    // sons run under the token of the father, and this one too if it's set.
+    cancel_token_t  token;
+} chroutine_attr_t;
+
 typedef int64_t chroutine_id_t;
+
+class chroutine_t;
+class chroutine_thread_t;
+
+// chroutine ids are handles of this table, with the thread a chroutine belongs to.
+// the id of a finished chroutine turns stale, even if its slot is reused.
+typedef handle_table_t<chroutine_t, chroutine_thread_t> chroutine_table_t;
+
+// chroutine_t is carved from the slab of the creating thread (see slab_t),
+// and it counts its references by itself, held by intrusive_ptr_t.
+// it never moves in memory, even if resettled to another thread.
 class chroutine_t
 {
     friend class chroutine_thread_t;
+    friend struct ready_queue_t;
 
 public:
-    chroutine_t(chroutine_id_t id);
+    chroutine_t();
     ~chroutine_t();
 
-    chroutine_t(chroutine_t &&other);
+    static void *operator new(size_t size) {
+        return slab_t<chroutine_t>::alloc();
+    }
+    static void operator delete(void *p) {
+        slab_t<chroutine_t>::free(p);
+    }
 
-    // if wait is over, return 0
-    int wait(std::time_t now);
+    void add_ref() {
+        refs.fetch_add(1, std::memory_order_relaxed);
+    }
+    void release() {
+        if (refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            delete this;
+        }
+    }
 
-    // called when resume, return the timeout son id if exist
-    chroutine_id_t yield_over(son_result_t result = result_timeout);
+    // called when resume, return the token of the timeout son if exist, to cancel it
+    cancel_token_t yield_over(son_result_t result = result_timeout);
 
     // called when son is done
     void son_finished();
@@ -69,54 +182,197 @@ public:
         return me;
     }
 
-    // this task was moved to another thread, please remove it
-    void set_moved() {
-        moved = true;
+    bool use_shared_stack() const {
+        return shared_stack;
     }
-    bool has_moved() {
-        return moved;
+
+    // whether it can run on other threads
+    bool movable() const {
+        return !shared_stack && !pinned && !preemptible;
+    }
+
+    priority_t get_priority() const {
+        return priority;
+    }
+
+    // how many times it ran over MAX_RUN_MS_EACH without switching out
+    int get_overruns() const {
+        return overruns;
+    }
+
+    // the token it runs under, empty if none
+    const cancel_token_t & get_token() const {
+        return token;
+    }
+
+    // see cancel_shield_t
+    void shield_cancel(int delta) {
+        cancel_shields += delta;
+    }
+    bool cancel_shielded() const {
+        return cancel_shields > 0;
+    }
+
+    // @attr for a son of mine, it takes my priority class unless set,
+    // and it's cancelled with me
+    chroutine_attr_t son_attr(const chroutine_attr_t & attr) const {
+        chroutine_attr_t son = attr;
+        if (son.priority == priority_t::inherit) {
+            son.priority = priority;
+        }
+        if (!son.token.valid()) {
+            son.token = token;
+        } else if (token.valid() && son.token.state() != token.state()) {
+            son.token = token.child(0, son.token);
+        }
+        return son;
     }
     
 private:
     chroutine_t(const chroutine_t &) = delete;
+    chroutine_t(chroutine_t &&) = delete;
     chroutine_t& operator=(const chroutine_t &) = delete;
     chroutine_t& operator=(chroutine_t &&) = delete;
 
 private:
-    ucontext_t *        ctx = nullptr;
-    func_t              func = nullptr;
+    std::atomic<int>    refs{0};
+    list_hook_t<chroutine_t>    hook;   // in chroutines_ready or chroutines_to_free
+    list_hook_t<chroutine_t>    owned_hook; // in chroutines_owned
+    timer_node_t<chroutine_t>   timer;  // in chroutines_sleeping, or chroutines_napping if napping
+    context_t           ctx;
+    task_t              func;
     void *              arg = nullptr;
     chroutine_state_t   state = chroutine_state_suspend;
-    char *              stack = nullptr;
-    int                 yield_wait = 0; // yield by frame count
-    std::time_t         yield_to = 0;   // yield until some time
+    stack_mem_t         stack;
+    int                 yield_wait = 0; // yield by frame count, rounds left to skip in the ready queue
+    std::time_t         yield_to = 0;   // yield until some time, in us of mono_clock_t
+    bool                napping = false;
+    bool                parking = false;    // parked by park_current, till it's queued again
+    bool                unparked = false;   // queued by unpark_chroutine
+    bool                permit = false;     // unparked while not parking, the next park returns at once
     chroutine_id_t      me = INVALID_ID;
     chroutine_id_t      father = INVALID_ID;
     chroutine_id_t      son = INVALID_ID;
+    cancel_token_t      son_token;  // cancels the son when the wait for it times out
+    cancel_token_t      token;
+    size_t              token_slot = 0; // see cancel_state_t::attach
+    int                 cancel_shields = 0;
     reporter_sptr_t     reporter;   // son chroutine excute result
     bool                stop_son_when_yield_over = false;
-    bool                moved = false;
+    bool                shared_stack = false;
+    bool                pinned = false;
+    bool                preemptible = false;
+    int                 overruns = 0;
+    priority_t          priority = priority_t::normal;
+    const char *        tag = nullptr;
+    bool                painted = false;    // the stack was painted for measurement
+    char *              save_buf = nullptr; // saved frames when on the shared stack
+    size_t              save_size = 0;
+    size_t              save_cap = 0;
+
+public:
+    typedef intrusive_list_t<chroutine_t, &chroutine_t::hook> list_t;
+    typedef intrusive_list_t<chroutine_t, &chroutine_t::owned_hook> owned_list_t;
 };
 
+typedef intrusive_ptr_t<chroutine_t> chroutine_ptr_t;
 
-typedef std::list<std::shared_ptr<chroutine_t> > chroutine_list_t;
-typedef std::unordered_map<chroutine_id_t, std::shared_ptr<chroutine_t> > chroutine_map_t;
+typedef chroutine_t::list_t chroutine_list_t;
+typedef chroutine_t::owned_list_t chroutine_owned_list_t;
 
+// ready chroutines, a FIFO queue for each priority class.
+// the highest class with a ready one is picked, but a lower class waiting
+// while STARVE_PICKS picks were made from higher ones is picked next,
+// so each class gets at least 1/(STARVE_PICKS+1) of the picks when it has work.
+typedef struct ready_queue_t {
+    chroutine_list_t    lists[PRIORITY_CLASSES];
+    int                 passed[PRIORITY_CLASSES] = {0}; // picks from higher classes while waiting
+
+    static int class_of(const chroutine_t *co) {
+        return static_cast<int>(co->priority);
+    }
+
+    bool empty() const {
+        return size() == 0;
+    }
+    size_t size() const {
+        size_t total = 0;
+        for (int c = 0; c < PRIORITY_CLASSES; c++) {
+            total += lists[c].size();
+        }
+        return total;
+    }
+
+    void push_back(chroutine_t *co) {
+        lists[class_of(co)].push_back(co);
+    }
+    void remove(chroutine_t *co) {
+        lists[class_of(co)].remove(co);
+    }
+    chroutine_t *pop_front() {
+        for (int c = 0; c < PRIORITY_CLASSES; c++) {
+            if (!lists[c].empty()) {
+                return lists[c].pop_front();
+            }
+        }
+        return nullptr;
+    }
+
+    // unlink the next one to run, nullptr if all of them have rounds to skip (yield_wait)
+    chroutine_t *pick();
+
+private:
+    // the first one of class @c without rounds to skip, the skipped ones are requeued
+    chroutine_t *pick_from(int c);
+} ready_queue_t;
+
+// each chroutine is owned by chroutines_owned (holding a reference), and it is:
+// - running: the one of running_id
+// - ready: in chroutines_ready, picked by priority class, in FIFO order in a class
+// - parked: in no list, waiting for an awake, or the deadline in chroutines_sleeping (ms ticks)
+//   or chroutines_napping (us ticks, for the near sub-ms deadlines)
+// finished ones are moved to chroutines_to_free with the reference.
+// a chroutine is found by id through chroutine_table_t.
 typedef struct schedule_t {
-    ucontext_t          main;
+    context_t           main;
     chroutine_id_t      running_id;
-    chroutine_map_t     chroutines_map; // for const id index
+    chroutine_owned_list_t  chroutines_owned;
     
-    chroutine_list_t    chroutines_sched;     // for sequence sched
+    ready_queue_t       chroutines_ready;
+    timing_wheel_t<chroutine_t>     chroutines_sleeping;
+    timing_wheel_t<chroutine_t>     chroutines_napping;
     chroutine_list_t    chroutines_to_free;
-    chroutine_list_t::iterator      sched_iter;
 
     schedule_t() 
     : running_id(INVALID_ID)
-    , sched_iter(chroutines_sched.end())
+    , chroutines_sleeping(mono_clock_t::now_ms())
+    , chroutines_napping(mono_clock_t::now_us())
     {}    
 }schedule_t;
 
+typedef enum {
+    inbox_spawn = 0,    // a new chroutine
+    inbox_adopt,        // a chroutine resettled from another thread
+    inbox_awake,        // awake a chroutine by id
+    inbox_unpark,       // unpark a chroutine by id
+    inbox_interrupt,    // wake a cancelled chroutine by id
+} inbox_op_t;
+
+// a request from another thread, taken by the owner thread in its loop
+typedef struct inbox_msg_t {
+    inbox_msg_t *       next = nullptr;
+    inbox_op_t          op = inbox_awake;
+    chroutine_t *       co = nullptr;   // holding a reference, for spawn and adopt
+    chroutine_id_t      id = INVALID_ID;
+
+    static void *operator new(size_t size) {
+        return slab_t<inbox_msg_t>::alloc();
+    }
+    static void operator delete(void *p) {
+        slab_t<inbox_msg_t>::free(p);
+    }
+} inbox_msg_t;
+
 typedef enum {
     thread_state_t_init = 0,
     thread_state_t_running,
@@ -177,14 +433,29 @@ public:
     // when timeout happens, continue running.
     void sleep(std::time_t wait_time_ms);
 
+    // wait() and sleep() in us
+    void wait_us(std::time_t wait_time_us);
+    void sleep_us(std::time_t wait_time_us);
+
     // create a chroutine
-    chroutine_id_t create_chroutine(func_t & func, void *arg);
+    chroutine_id_t create_chroutine(task_t & func, void *arg, const chroutine_attr_t & attr = chroutine_attr_t());
     
     // create a son chroutine of current chroutine
-    chroutine_id_t create_son_chroutine(func_t & func, const reporter_sptr_t & reporter);
+    chroutine_id_t create_son_chroutine(task_t & func, const reporter_sptr_t & reporter, const chroutine_attr_t & attr = chroutine_attr_t());
+
+    // pin the thread to @cpus when it starts, call it before start().
+    // the main thread is pinned when it begins to schedule.
+    void set_cpus(const cpu_list_t & cpus) {
+        m_cpus = cpus;
+    }
+
+    // the NUMA node it's pinned to, -1 if not pinned to one node
+    int node() const {
+        return m_node.load(std::memory_order_relaxed);
+    }
 
     // start the thread
-    void start(size_t creating_index);
+    void start();
     
     // start the thread
     void stop();
@@ -206,41 +477,126 @@ public:
         return m_schedule.running_id;
     }
     
-    // awake waiting chroutine
+    // awake waiting chroutine.
+    // called by another thread, it's posted to the inbox and 0 is returned.
     int awake_chroutine(chroutine_id_t id);
 
+    // awake waiting chroutines, posted by a single operation if called by another thread
+    void awake_chroutines(const chroutine_id_t *ids, size_t count);
+
+    // park the current chroutine until it's unparked, or the @deadline (us of mono_clock_t, 0: none).
+    // it's in no queue and costs nothing till then. return true if it was unparked,
+    // false if timed out, or awaken by awake_chroutine. check what you wait for again anyway.
+    bool park_current(std::time_t deadline);
+
+    // unpark @id, if it's not parked now, its next park returns at once.
+    // called by another thread, it's posted to the inbox and 0 is returned.
+    int unpark_chroutine(chroutine_id_t id);
+
+    // wake the cancelled chroutine @id if it's sleeping, waiting or parked,
+    // so it sees the cancellation. called by another thread, it's posted to the inbox.
+    int interrupt_chroutine(chroutine_id_t id);
+
     void set_type(thread_type_t type) {
         m_type = type;
     }
+
+    thread_type_t type() const {
+        return m_type;
+    }
     
     // the while loop of the thread
     int schedule();
 
     std::time_t entry_time();
 
-    // this thread is blocked, move chroutines to other thread.
-    void move_chroutines_to_thread(const std::shared_ptr<chroutine_thread_t> & other_thread);
+    // this thread is blocked, move chroutines to @others, spread by their load.
+    // return the count moved.
+    size_t move_chroutines_to_thread(const std::vector<chroutine_thread_t *> & others);
+
+    // the chroutine running now and its tag, INVALID_ID if none
+    chroutine_id_t blocker(std::string & tag);
+
+    // let the thread hand its chroutines over to the other workers and exit.
+    // it must be unpublished from the engine first, so nothing new is placed here.
+    void retire();
+
+    // whether it can be retired: all its chroutines can move, and it selects
+    // no more than the @own_selectors the engine registered for itself.
+    bool retirable(size_t own_selectors);
+
+    // parked, waiting for a kick
+    bool parked() const {
+        return m_parked.load();
+    }
 
     void set_state(thread_state_t state);
 
     thread_state_t state();
 
-    static chroutine_id_t gen_chroutine_id() {
-        return ++ms_chroutine_id;
-    }
+    // adopt a chroutine from a blocked thread, it was unlinked from that thread.
+    // called by another thread, it's posted to the inbox.
+    chroutine_id_t resettle(const chroutine_ptr_t &chroutine);
 
-    chroutine_id_t resettle(chroutine_t &chroutine);
+    // unlink some ready chroutines for an idle thread to steal, at most half of them,
+    // taken from the tail. the ones with a father or son are left, as they find each other here.
+    // return the count put in @stolen.
+    size_t give_away(std::vector<chroutine_ptr_t> & stolen, chroutine_thread_t *thief);
+
+    // kick the thread if it's parked, return false if it's not
+    bool wake_idle();
+
+    bool in_own_thread() const {
+        return std::this_thread::get_id() == m_std_thread_id;
+    }
 
     // get the load of this thread, >=1 means the thread is full.
     float load() {
         return m_load.load();
     }
 
+    // how much work is waiting here, for placing new chroutines:
+    // the ready ones, plus one if running one now, plus the load
+    float pressure() {
+        return m_ready_depth.load(std::memory_order_relaxed)
+            + (entry_time() != 0 ? 1 : 0)
+            + load();
+    }
+
     const std::thread::id & thread_id() {
         return m_std_thread_id;
     }
     void update_thread_id();
 
+    // the thread scheduling on the calling os thread, nullptr if none
+    static chroutine_thread_t *current() {
+        return ms_current;
+    }
+
+    // the chroutine running on the calling os thread, nullptr if none
+    static chroutine_t *current_chroutine() {
+        return ms_running;
+    }
+
+    // switch the running chroutine out if it ran over its time slice
+    void preempt_point() {
+        if (m_preempt_pending.load(std::memory_order_relaxed) && ms_current == this) {
+            yield_current(1);
+        }
+    }
+
+    // called by the slice timer of the engine: flag the running chroutine if it ran over
+    // MAX_RUN_MS_EACH, and signal the thread once per slice if the chroutine is preemptible.
+    void check_slice(std::time_t now);
+
+    // overruns of chroutine @id, -1 if it's not on this thread
+    int get_overruns(chroutine_id_t id);
+
+    // overruns of all chroutines ran on this thread
+    uint64_t overruns() const {
+        return m_overruns.load(std::memory_order_relaxed);
+    }
+
 private:
     chroutine_thread_t();
     
@@ -252,8 +608,8 @@ private:
     // called by yield
     void yield_current(int tick);
 
-    // called by wait/sleep
-    void wait_current(std::time_t wait_time_ms, bool stop_son_after_wait);
+    // called by wait/sleep, @deadline in us of mono_clock_t
+    void wait_current(std::time_t deadline, bool stop_son_after_wait);
     
     // where the funcs of chroutines were called
     static void entry(void *arg);
@@ -269,10 +625,78 @@ private:
 
     // get chroutine pointer by id
     chroutine_t * get_chroutine(chroutine_id_t id);
+
+    // the chroutine of @id if it belongs to this thread, m_chroutine_lock must be held
+    chroutine_t * find(chroutine_id_t id);
     
     // remove chroutine by id
     void remove_chroutine(chroutine_id_t id);
 
+    // queue a parked chroutine to run, its deadline is canceled
+    void make_ready(chroutine_t *co);
+
+    // publish the size of chroutines_ready for pressure()
+    void update_ready_depth() {
+        m_ready_depth.store(m_schedule.chroutines_ready.size(), std::memory_order_relaxed);
+    }
+
+    // park a chroutine until @deadline (us of mono_clock_t).
+    // a whole ms one goes to chroutines_sleeping, and a near sub-ms one to chroutines_napping
+    void park_until(chroutine_t *co, std::time_t deadline);
+
+    // cancel the deadline of a parked chroutine
+    void cancel_sleep(chroutine_t *co);
+
+    // queue the sleeping chroutines whose deadline is over, @now in us
+    void expire_sleeping(std::time_t now);
+
+    // the earliest deadline before @limit, in us
+    std::time_t next_expire(std::time_t limit);
+
+    // awake @id, and get the son to remove if it timed out
+    bool awake(chroutine_id_t id, cancel_token_t & timeout_son);
+
+    // unpark @id or give it the permit
+    bool unpark(chroutine_id_t id);
+
+    // queue @id if it's in no queue and not running
+    bool interrupt(chroutine_id_t id);
+
+    // the earlier of @deadline (0: none) and the deadline of @co's token
+    static std::time_t clamp_deadline(const chroutine_t *co, std::time_t deadline);
+
+    // take a chroutine into the owned list, and queue or park it
+    void adopt(const chroutine_ptr_t &chroutine);
+
+    // the helpers above must be called with m_chroutine_lock held
+
+    // send an awake (or unpark) not found here to the thread owning @id now
+    int forward_awake(chroutine_id_t id, inbox_op_t op = inbox_awake);
+
+    // wake the thread up if it's parked, lock free
+    bool kick();
+
+    // clear the parked flag, return false if it was cleared already
+    bool unpark();
+
+    // park the idle thread until kicked or the next deadline
+    void park();
+
+    // @queued chroutines are ready here, let an idle worker come and steal if there are many.
+    void call_thief(size_t queued);
+
+    // steal chroutines from other workers, return the count
+    size_t steal();
+
+    // post requests to the inbox from another thread
+    void post(inbox_msg_t *first);
+
+    // run the requests in the inbox, return the count
+    int drain_inbox();
+
+    // release the requests never run
+    void drop_inbox();
+
     // select all selectable_object_it
     // rpc/tcp/http/pipe for this thread
     int select_all();
@@ -282,19 +706,75 @@ private:
 
     void clear_all_chroutine();
 
+    // the stack of a new chroutine @co, its size is set already
+    bool make_stack(chroutine_t *co);
+
+    // unlink the movable chroutines and resettle them to @others, the least loaded first
+    size_t hand_out(const std::vector<chroutine_thread_t *> & others);
+
+    // hand the chroutines out while retiring, true when nothing left to do here
+    bool hand_over();
+
+    // copy frames between the shared stack and the save buffer of @co
+    void save_shared_stack(chroutine_t *co);
+    void restore_shared_stack(chroutine_t *co);
+
+    // make the shared stack ready for @co before switching to it
+    void switch_shared_stack(chroutine_t *co);
+
+    // install the handler of PREEMPT_SIGNAL, once per process,
+    // when the first preemptible chroutine is created
+    static void install_preempt_handler();
+
+    // switch out the running chroutine from the handler of PREEMPT_SIGNAL, if it's safe
+    static void on_preempt_signal(int signo);
+    void preempt_running();
+
+    // keeps PREEMPT_SIGNAL from switching the running chroutine out inside the engine
+    typedef struct preempt_off_t {
+        sig_atomic_t saved;
+        preempt_off_t() : saved(ms_preemptible) {
+            ms_preemptible = 0;
+        }
+        ~preempt_off_t() {
+            ms_preemptible = saved;
+        }
+    } preempt_off_t;
+
 private:
     schedule_t                               m_schedule;
     bool                                     m_is_running = false;
-    bool                                     m_need_stop = false;
-    size_t                                   m_creating_index = 0;
+    std::atomic<bool>                        m_need_stop{false};
     selectable_object_list_t                 m_selector_list;
-    chutex_t                                 m_chroutine_lock;
+    std::atomic<size_t>                      m_selectors{0};    // size of m_selector_list, read by other threads
+    std::atomic<bool>                        m_retiring{false};
+    std::time_t                              m_retire_since = 0;    // used by the thread itself only
+    cpu_list_t                               m_cpus;            // pinned to, see set_cpus
+    std::atomic<int>                         m_node{-1};
+    std::mutex                               m_chroutine_lock;  // never yields, as it guards the schedule itself
+    std::atomic<bool>                        m_parked{false};   // waiting for a kick
+    inbox_t<inbox_msg_t>                     m_inbox;           // requests from other threads
+    int                                      m_kick_fd = -1;    // eventfd the parked thread waits on
+    int                                      m_idle_rounds = 0;
+    std::atomic<size_t>                      m_ready_depth{0};
     std::atomic<std::time_t>                 m_entry_time;  // for thread alive check
+    std::atomic<bool>                        m_preempt_pending{false};      // the running one ran over its slice
+    std::atomic<bool>                        m_running_preemptible{false};  // the running one is preemptible
+    std::atomic<uint64_t>                    m_overruns{0};
+    std::time_t                              m_preempt_signaled = 0;    // the slice signaled, used by check_slice only
+    pthread_t                                m_native_thread;
     std::atomic<thread_state_t>              m_state;
-    static std::atomic<chroutine_id_t>       ms_chroutine_id;
     load_t                                   m_load;
     thread_type_t                            m_type = thread_type_t::worker;
     std::thread::id                          m_std_thread_id;
+    stack_mem_t                              m_shared_stack;
+    chroutine_t *                            m_shared_stack_owner = nullptr; // whose frames are on the shared stack
+
+    // set by schedule() and on every switch, so YIELD etc. need no lookup
+    static thread_local chroutine_thread_t * ms_current;
+    static thread_local chroutine_t *        ms_running;
+    // the running chroutine is preemptible, and it's out of the engine
+    static thread_local volatile sig_atomic_t ms_preemptible;
 };
 
 }
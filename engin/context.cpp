@@ -0,0 +1,215 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "context.hpp"
+
+#ifdef CHR_CONTEXT_ASM
+
+// void chr_ctx_swap(void **from_sp, void *to_sp)
+// push callee-saved registers on the current stack, save sp to *from_sp,
+// then load to_sp and pop the registers of the target.
+//
+// void chr_ctx_trampoline()
+// first "return" of a new context, calls entry(arg) prepared by context_make.
+extern "C" void chr_ctx_swap(void **from_sp, void *to_sp);
+extern "C" void chr_ctx_trampoline();
+
+#if defined(__x86_64__)
+// frame (from low to high): pad, mxcsr, x87 cw, r12, r13, r14, r15, rbx, rbp, ret
+asm(R"(
+    .pushsection .text
+    .globl  chr_ctx_swap
+    .type   chr_ctx_swap, @function
+    .align  16
+chr_ctx_swap:
+    pushq   %rbp
+    pushq   %rbx
+    pushq   %r15
+    pushq   %r14
+    pushq   %r13
+    pushq   %r12
+    subq    $16, %rsp
+    stmxcsr 8(%rsp)
+    fnstcw  12(%rsp)
+    movq    %rsp, (%rdi)
+    movq    %rsi, %rsp
+    ldmxcsr 8(%rsp)
+    fldcw   12(%rsp)
+    addq    $16, %rsp
+    popq    %r12
+    popq    %r13
+    popq    %r14
+    popq    %r15
+    popq    %rbx
+    popq    %rbp
+    ret
+    .size   chr_ctx_swap, .-chr_ctx_swap
+
+    .globl  chr_ctx_trampoline
+    .type   chr_ctx_trampoline, @function
+    .align  16
+chr_ctx_trampoline:
+    movq    %r13, %rdi
+    callq   *%r12
+    ud2
+    .size   chr_ctx_trampoline, .-chr_ctx_trampoline
+    .popsection
+)");
+
+namespace {
+const size_t FRAME_WORDS = 9;   // pad, csr, r12, r13, r14, r15, rbx, rbp, ret
+}
+
+#elif defined(__aarch64__)
+// frame (from low to high): x19-x28, x29, x30(lr), d8-d15
+asm(R"(
+    .pushsection .text
+    .globl  chr_ctx_swap
+    .type   chr_ctx_swap, %function
+    .align  4
+chr_ctx_swap:
+    sub     sp, sp, #160
+    stp     x19, x20, [sp, #0]
+    stp     x21, x22, [sp, #16]
+    stp     x23, x24, [sp, #32]
+    stp     x25, x26, [sp, #48]
+    stp     x27, x28, [sp, #64]
+    stp     x29, x30, [sp, #80]
+    stp     d8,  d9,  [sp, #96]
+    stp     d10, d11, [sp, #112]
+    stp     d12, d13, [sp, #128]
+    stp     d14, d15, [sp, #144]
+    mov     x9, sp
+    str     x9, [x0]
+    mov     sp, x1
+    ldp     x19, x20, [sp, #0]
+    ldp     x21, x22, [sp, #16]
+    ldp     x23, x24, [sp, #32]
+    ldp     x25, x26, [sp, #48]
+    ldp     x27, x28, [sp, #64]
+    ldp     x29, x30, [sp, #80]
+    ldp     d8,  d9,  [sp, #96]
+    ldp     d10, d11, [sp, #112]
+    ldp     d12, d13, [sp, #128]
+    ldp     d14, d15, [sp, #144]
+    add     sp, sp, #160
+    ret
+    .size   chr_ctx_swap, .-chr_ctx_swap
+
+    .globl  chr_ctx_trampoline
+    .type   chr_ctx_trampoline, %function
+    .align  4
+chr_ctx_trampoline:
+    mov     x0, x20
+    blr     x19
+    brk     #0
+    .size   chr_ctx_trampoline, .-chr_ctx_trampoline
+    .popsection
+)");
+
+namespace {
+const size_t FRAME_WORDS = 20;
+}
+
+#endif
+
+namespace chr {
+
+void context_make(context_t *ctx, char *stack, size_t size, context_entry_t entry, void *arg)
+{
+    uintptr_t top = (reinterpret_cast<uintptr_t>(stack) + size) & ~static_cast<uintptr_t>(15);
+
+#if defined(__x86_64__)
+    // `ret` of chr_ctx_swap pops the trampoline, the stack must be 16 aligned
+    // when the trampoline calls entry. keep 16 bytes above as a fake caller frame.
+    uintptr_t *frame = reinterpret_cast<uintptr_t *>(top - 16 - FRAME_WORDS * sizeof(uintptr_t));
+    memset(frame, 0, (FRAME_WORDS + 2) * sizeof(uintptr_t));
+    uint32_t *csr = reinterpret_cast<uint32_t *>(&frame[1]);
+    csr[0] = 0x1F80;    // default mxcsr
+    csr[1] = 0x037F;    // default x87 control word
+    frame[2] = reinterpret_cast<uintptr_t>(entry);    // r12
+    frame[3] = reinterpret_cast<uintptr_t>(arg);      // r13
+    frame[FRAME_WORDS - 1] = reinterpret_cast<uintptr_t>(&chr_ctx_trampoline);
+#elif defined(__aarch64__)
+    uintptr_t *frame = reinterpret_cast<uintptr_t *>(top - FRAME_WORDS * sizeof(uintptr_t));
+    memset(frame, 0, FRAME_WORDS * sizeof(uintptr_t));
+    frame[0] = reinterpret_cast<uintptr_t>(entry);    // x19
+    frame[1] = reinterpret_cast<uintptr_t>(arg);      // x20
+    frame[11] = reinterpret_cast<uintptr_t>(&chr_ctx_trampoline);   // x30
+#endif
+    ctx->sp = frame;
+}
+
+void context_swap(context_t *from, context_t *to)
+{
+    chr_ctx_swap(&from->sp, to->sp);
+}
+
+void *context_sp(const context_t *ctx)
+{
+    return ctx->sp;
+}
+
+bool context_has_sp()
+{
+    return true;
+}
+
+const char *context_backend()
+{
+#if defined(__x86_64__)
+    return "asm-x86_64";
+#else
+    return "asm-aarch64";
+#endif
+}
+
+}
+
+#else
+
+namespace chr {
+
+void context_make(context_t *ctx, char *stack, size_t size, context_entry_t entry, void *arg)
+{
+    getcontext(&ctx->uc);
+    ctx->uc.uc_stack.ss_sp = stack;
+    ctx->uc.uc_stack.ss_size = size;
+    ctx->uc.uc_stack.ss_flags = 0;
+    ctx->uc.uc_link = nullptr;
+    makecontext(&ctx->uc, (void (*)(void))(entry), 1, arg);
+}
+
+void context_swap(context_t *from, context_t *to)
+{
+    swapcontext(&from->uc, &to->uc);
+}
+
+void *context_sp(const context_t *ctx)
+{
+#if defined(__x86_64__)
+    return reinterpret_cast<void *>(ctx->uc.uc_mcontext.gregs[REG_RSP]);
+#elif defined(__aarch64__)
+    return reinterpret_cast<void *>(ctx->uc.uc_mcontext.sp);
+#else
+    return nullptr;
+#endif
+}
+
+bool context_has_sp()
+{
+#if defined(__x86_64__) || defined(__aarch64__)
+    return true;
+#else
+    return false;
+#endif
+}
+
+const char *context_backend()
+{
+    return "ucontext";
+}
+
+}
+
+#endif
@@ -0,0 +1,54 @@
+/// \file context.hpp
+///
+/// context_t is the cpu context of a chroutine.
+/// the switch is done by hand-written assembly on x86-64 and aarch64,
+/// which only saves the callee-saved registers.
+/// on other platforms, or if `CHR_USE_UCONTEXT` is defined at build time,
+/// it falls back to ucontext (swapcontext saves the signal mask with a syscall).
+///
+/// \author ingangi
+/// \version 0.1.0
+/// \date 2026-10-17
+
+#ifndef CONTEXT_HPP
+#define CONTEXT_HPP
+
+#include <stddef.h>
+
+#if !defined(CHR_USE_UCONTEXT) && (defined(__x86_64__) || defined(__aarch64__))
+#define CHR_CONTEXT_ASM
+#else
+#include <ucontext.h>
+#endif
+
+namespace chr {
+
+typedef void (*context_entry_t)(void *arg);
+
+typedef struct context_t {
+#ifdef CHR_CONTEXT_ASM
+    void *      sp = nullptr;   // all registers were pushed on the stack
+#else
+    ucontext_t  uc;
+#endif
+} context_t;
+
+// prepare @ctx to call @entry(@arg) on stack [@stack, @stack + @size) when switched to.
+// @entry must never return, it should switch to another context at the end.
+void context_make(context_t *ctx, char *stack, size_t size, context_entry_t entry, void *arg);
+
+// save the current context to @from, and run @to.
+void context_swap(context_t *from, context_t *to);
+
+// the stack pointer saved in a switched out @ctx, the frames in use are in [sp, stack top).
+void *context_sp(const context_t *ctx);
+
+// whether the backend can tell the stack pointer (the shared stack is not available if not)
+bool context_has_sp();
+
+// name of the backend, for logs and benchmarks
+const char *context_backend();
+
+}
+
+#endif
@@ -0,0 +1,179 @@
+#include <unistd.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fstream>
+#include "cpu_topology.hpp"
+#include "logger.hpp"
+
+namespace chr {
+
+namespace {
+
+bool read_line(const std::string & path, std::string & line)
+{
+    std::ifstream file(path);
+    return file && std::getline(file, line);
+}
+
+}
+
+int cpu_topology_t::node_count()
+{
+    return static_cast<int>(topology().nodes.size());
+}
+
+int cpu_topology_t::node_of_cpu(int cpu)
+{
+    const topology_t & topo = topology();
+    if (cpu < 0 || cpu >= static_cast<int>(topo.cpu_nodes.size())) {
+        return 0;
+    }
+    return topo.cpu_nodes[cpu];
+}
+
+cpu_list_t cpu_topology_t::cpus_of_node(int node)
+{
+    const topology_t & topo = topology();
+    if (node < 0 || node >= static_cast<int>(topo.nodes.size())) {
+        return cpu_list_t();
+    }
+    return topo.nodes[node];
+}
+
+cpu_list_t cpu_topology_t::interleaved_cpus()
+{
+    const topology_t & topo = topology();
+    cpu_list_t cpus;
+    for (size_t i = 0; ; i++) {
+        size_t before = cpus.size();
+        for (auto &node : topo.nodes) {
+            if (i < node.size()) {
+                cpus.push_back(node[i]);
+            }
+        }
+        if (cpus.size() == before) {
+            break;
+        }
+    }
+    return cpus;
+}
+
+int cpu_topology_t::node_of_cpus(const cpu_list_t & cpus)
+{
+    int node = -1;
+    for (auto cpu : cpus) {
+        int n = node_of_cpu(cpu);
+        if (node >= 0 && n != node) {
+            return -1;
+        }
+        node = n;
+    }
+    return node;
+}
+
+int cpu_topology_t::current_node()
+{
+    return node_of_cpu(sched_getcpu());
+}
+
+cpu_list_t cpu_topology_t::parse_cpu_list(const std::string & text)
+{
+    cpu_list_t cpus;
+    const char *p = text.c_str();
+    while (*p) {
+        char *end = nullptr;
+        long first = strtol(p, &end, 10);
+        if (end == p) {
+            break;
+        }
+        long last = first;
+        p = end;
+        if (*p == '-') {
+            last = strtol(p + 1, &end, 10);
+            p = end;
+        }
+        for (long cpu = first; cpu <= last; cpu++) {
+            cpus.push_back(static_cast<int>(cpu));
+        }
+        if (*p == ',') {
+            p++;
+        } else {
+            break;
+        }
+    }
+    return cpus;
+}
+
+bool cpu_topology_t::pin(pthread_t thread, const cpu_list_t & cpus)
+{
+    if (cpus.empty()) {
+        return false;
+    }
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (auto cpu : cpus) {
+        if (cpu >= 0 && cpu < CPU_SETSIZE) {
+            CPU_SET(cpu, &set);
+        }
+    }
+    int ret = pthread_setaffinity_np(thread, sizeof(set), &set);
+    if (ret != 0) {
+        SPDLOG(ERROR, "cpu_topology_t pin to {} cpus failed: {}", cpus.size(), strerror(ret));
+        return false;
+    }
+    return true;
+}
+
+const cpu_topology_t::topology_t & cpu_topology_t::topology()
+{
+    static topology_t topo = load();
+    return topo;
+}
+
+cpu_topology_t::topology_t cpu_topology_t::load()
+{
+    topology_t topo;
+    std::string line;
+    if (read_line("/sys/devices/system/node/online", line)) {
+        for (auto node : parse_cpu_list(line)) {
+            std::string cpus;
+            if (!read_line("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist", cpus)) {
+                continue;
+            }
+            // the ids of nodes are dense almost always, a hole is just an empty node here
+            if (node >= static_cast<int>(topo.nodes.size())) {
+                topo.nodes.resize(node + 1);
+            }
+            topo.nodes[node] = parse_cpu_list(cpus);
+        }
+    }
+
+    if (topo.nodes.empty()) {
+        cpu_list_t cpus;
+        if (read_line("/sys/devices/system/cpu/online", line)) {
+            cpus = parse_cpu_list(line);
+        } else {
+            long count = sysconf(_SC_NPROCESSORS_ONLN);
+            for (long cpu = 0; cpu < count; cpu++) {
+                cpus.push_back(static_cast<int>(cpu));
+            }
+        }
+        topo.nodes.push_back(cpus);
+    }
+
+    for (size_t node = 0; node < topo.nodes.size(); node++) {
+        for (auto cpu : topo.nodes[node]) {
+            if (cpu >= static_cast<int>(topo.cpu_nodes.size())) {
+                topo.cpu_nodes.resize(cpu + 1, 0);
+            }
+            topo.cpu_nodes[cpu] = static_cast<int>(node);
+        }
+    }
+
+    SPDLOG(INFO, "cpu_topology_t: {} nodes, {} cpus", topo.nodes.size(), topo.cpu_nodes.size());
+    return topo;
+}
+
+}
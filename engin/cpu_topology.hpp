@@ -0,0 +1,80 @@
+/// \file cpu_topology.hpp
+///
+/// cpu_topology_t knows which NUMA node each cpu is on, read from sysfs once.
+/// a box without NUMA (or without sysfs) is taken as one node with all the cpus.
+///
+/// it also pins threads to cpus. a thread pinned to the cpus of one node gets
+/// its memory from that node, as the kernel places a page on the node of the
+/// thread touching it first. so the stacks and slabs of a pinned worker,
+/// which are mapped and touched by the worker itself, are node local.
+///
+/// \author ingangi
+/// \version 0.1.0
+/// \date 2026-10-17
+
+#ifndef CPU_TOPOLOGY_HPP
+#define CPU_TOPOLOGY_HPP
+
+#include <pthread.h>
+#include <string>
+#include <vector>
+
+namespace chr {
+
+typedef std::vector<int> cpu_list_t;
+
+// where the threads of the engine run, see engine_t::init
+typedef struct affinity_config_t {
+    // the workers are pinned to these cpus in turn, one cpu each,
+    // or all to the whole list if one_cpu_each is false. empty: not pinned.
+    cpu_list_t  worker_cpus;
+    bool        one_cpu_each = true;
+
+    cpu_list_t  epoll_cpus;     // the epoll thread, empty: not pinned
+    cpu_list_t  main_cpus;      // the main thread (engine_t::run), empty: not pinned
+
+    // new chroutines and stealing prefer the workers on the node of the caller
+    bool        numa_local = true;
+} affinity_config_t;
+
+class cpu_topology_t final
+{
+public:
+    // count of NUMA nodes, 1 at least
+    static int node_count();
+
+    // the node of @cpu, 0 if unknown
+    static int node_of_cpu(int cpu);
+
+    // the cpus of @node
+    static cpu_list_t cpus_of_node(int node);
+
+    // all the online cpus, node by node in turns: the first of node 0, the first of node 1,
+    // then the second of node 0... pinning workers to it in turn spreads them over the nodes.
+    static cpu_list_t interleaved_cpus();
+
+    // the node all of @cpus are on, -1 if they are on more than one or empty
+    static int node_of_cpus(const cpu_list_t & cpus);
+
+    // the node the calling thread runs on now
+    static int current_node();
+
+    // parse a cpu list like "0-3,8,10-11"
+    static cpu_list_t parse_cpu_list(const std::string & text);
+
+    // pin @thread to @cpus, false if failed
+    static bool pin(pthread_t thread, const cpu_list_t & cpus);
+
+private:
+    typedef struct topology_t {
+        std::vector<cpu_list_t> nodes;      // cpus of each node
+        std::vector<int>        cpu_nodes;  // node of each cpu
+    } topology_t;
+
+    static const topology_t & topology();
+    static topology_t load();
+};
+
+}
+
+#endif
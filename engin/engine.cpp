@@ -9,8 +9,9 @@ void signal_handle(int signal_num){
 
 namespace chr {
     
-const static int MAX_ENTRY_CALL_TIME_MS = 500;
-const static int ENTRY_CALL_CHECK_TIMER_MS = MAX_ENTRY_CALL_TIME_MS/2;
+const static int POOL_CHECK_MS = 250;
+const static int SLICE_CHECK_MS = MAX_RUN_MS_EACH/2;
+const static int RETIRED_KEEP_MS = 10000;   // readers are done with a retired worker long before this
 
 
 engine_t& engine_t::instance()
@@ -31,23 +32,44 @@ engine_t::~engine_t()
 
 void engine_t::init(size_t init_pool_size)
 {
-    if (!m_creating.empty())
+    pool_config_t config;
+    config.min_workers = init_pool_size;
+    config.max_workers = init_pool_size;
+    init(config);
+}
+
+void engine_t::init(const pool_config_t & config)
+{
+    if (!m_threads.empty())
         return;
+
+    m_config = config;
+    if (m_config.min_workers < 1)
+        m_config.min_workers = 1;
+    if (m_config.max_workers > MAX_WORKERS)
+        m_config.max_workers = MAX_WORKERS;
+    if (m_config.max_workers < m_config.min_workers)
+        m_config.max_workers = m_config.min_workers;
+    // it matters only if the workers are pinned to nodes
+    m_numa_local = m_config.affinity.numa_local && !m_config.affinity.worker_cpus.empty()
+        && cpu_topology_t::node_count() > 1;
+
+#ifdef ENABLE_HTTP_PLUGIN
+    curl_global_init(CURL_GLOBAL_ALL);
+#endif
      
 #ifdef ENABLE_EPOLL
     m_epoll_thread = chroutine_thread_t::new_thread();
     m_epoll_thread->set_type(thread_type_t::epoll);
-    m_epoll_thread->start(0);
+    m_epoll_thread->set_cpus(m_config.affinity.epoll_cpus);
+    m_epoll_thread->start();
 #endif
 
-    for (size_t i = 0; i < init_pool_size; i++) {
-        std::shared_ptr<chroutine_thread_t> thrd = chroutine_thread_t::new_thread();
-        thrd->set_type(thread_type_t::worker);
-        m_creating.push_back(thrd);
-        thrd->start(i);
+    for (size_t i = 0; i < m_config.min_workers; i++) {
+        add_worker();
     }
 
-    SPDLOG(INFO, "{}: init_pool_size = {}", __FUNCTION__, init_pool_size);
+    SPDLOG(INFO, "{}: min_workers = {}, max_workers = {}", __FUNCTION__, m_config.min_workers, m_config.max_workers);
 
     while (!m_init_over) {
         thread_ms_sleep(10);
@@ -56,34 +78,134 @@ void engine_t::init(size_t init_pool_size)
     // main thread do not need start()
     m_main_thread = chroutine_thread_t::new_thread();  
     m_main_thread->set_type(thread_type_t::main); 
+    m_main_thread->set_cpus(m_config.affinity.main_cpus);
+    start_watchdog();
     SPDLOG(INFO, "{}: OVER", __FUNCTION__);
 }
 
-void engine_t::on_thread_ready(size_t creating_index, std::thread::id thread_id)
+void engine_t::on_thread_ready(chroutine_thread_t *thrd)
 {
     std::lock_guard<std::mutex> lck (m_pool_lock);
-    if (creating_index > m_creating.size() - 1) {
-        return;
+    m_workers.add(thrd);
+
+#ifdef ENABLE_HTTP_PLUGIN
+    selectable_object_sptr_t s_this = curl_stub_t::create(thrd->thread_id());
+    if (s_this.get()) {
+        std::lock_guard<std::mutex> http_lock(m_http_lock);
+        m_http_stubs[thrd->thread_id()] = s_this;
     }
+#endif
 
-    m_pool[thread_id] = m_creating[creating_index];
-    if (m_pool.size() == m_creating.size()) {
+    if (!m_init_over && m_workers.size() == m_config.min_workers) {
         m_init_over = true; 
         SPDLOG(INFO, "{}: m_init_over now is TRUE", __FUNCTION__);
 
+#ifdef ENABLE_EPOLL
+        m_epoll = epoll_t::create();
+#endif
+    }
+}
+
+void engine_t::add_worker()
+{
+    std::shared_ptr<chroutine_thread_t> thrd = chroutine_thread_t::new_thread();
+    thrd->set_type(thread_type_t::worker);
+    {
+        std::lock_guard<std::mutex> lck (m_pool_lock);
+        const cpu_list_t & cpus = m_config.affinity.worker_cpus;
+        if (!cpus.empty() && m_config.affinity.one_cpu_each) {
+            thrd->set_cpus(cpu_list_t(1, cpus[m_next_cpu++ % cpus.size()]));
+        } else if (!cpus.empty()) {
+            thrd->set_cpus(cpus);
+        }
+        m_threads.push_back(thrd);
+    }
+    thrd->start();
+}
+
+void engine_t::retire_worker(chroutine_thread_t *thrd)
+{
+    std::lock_guard<std::mutex> lck (m_pool_lock);
+    if (!m_workers.remove(thrd))
+        return;
+
+    for (auto it = m_threads.begin(); it != m_threads.end(); it++) {
+        if (it->get() == thrd) {
+            retired_t retired;
+            retired.thread = *it;
+            retired.since = mono_clock_t::now_ms();
+            m_retired.push_back(retired);
+            m_threads.erase(it);
+            break;
+        }
+    }
+
 #ifdef ENABLE_HTTP_PLUGIN
-        curl_global_init(CURL_GLOBAL_ALL);
-        for (auto it = m_pool.begin(); it != m_pool.end(); it++) {
-            selectable_object_sptr_t s_this = curl_stub_t::create(it->first);
-            if (s_this.get()) {
-                m_http_stubs[it->first] = s_this;
+    {
+        std::lock_guard<std::mutex> http_lock(m_http_lock);
+        m_http_stubs.erase(thrd->thread_id());
+    }
+#endif
+    thrd->retire();
+}
+
+void engine_t::balance_pool(size_t blocked)
+{
+    size_t count = m_workers.size();
+    int parked = m_parked_workers.load();
+    float pressure = 0;
+    const float load_warning = 0.7;
+    m_workers.find_if([&pressure, load_warning](chroutine_thread_t *thrd) {
+        pressure += thrd->pressure();
+        float load = thrd->load();
+        if (load > load_warning) {
+            SPDLOG(WARN, "engine_t::balance_pool: {:p}, load warning: {} !", (void*)(thrd), load);
+        }
+        return false;
+    });
+
+    // free the retired ones long done
+    {
+        std::lock_guard<std::mutex> lck (m_pool_lock);
+        std::time_t now = mono_clock_t::now_ms();
+        for (auto it = m_retired.begin(); it != m_retired.end(); ) {
+            if (it->thread->state() == thread_state_t_finished && now - it->since > RETIRED_KEEP_MS) {
+                it = m_retired.erase(it);
+            } else {
+                it++;
             }
         }
-#endif
+    }
 
-#ifdef ENABLE_EPOLL
-        m_epoll = epoll_t::create();
+    // the blocked ones don't count, their chroutines were moved away
+    bool short_handed = count < m_config.min_workers + blocked;
+    bool want_grow = parked <= 0 && count > blocked && pressure / (count - blocked) > m_config.grow_pressure;
+    bool want_shrink = blocked == 0 && parked >= 2;
+    m_grow_streak = want_grow ? m_grow_streak + 1 : 0;
+    m_shrink_streak = want_shrink ? m_shrink_streak + 1 : 0;
+
+    // short handed grows it at once
+    if ((short_handed || m_grow_streak >= m_config.grow_checks) && count < m_config.max_workers) {
+        SPDLOG(INFO, "{}: add a worker to {}, blocked {}, pressure {}", __FUNCTION__, count, blocked, pressure);
+        m_grow_streak = 0;
+        add_worker();
+        return;
+    }
+
+    if (m_shrink_streak >= m_config.shrink_checks && count > m_config.min_workers) {
+        m_shrink_streak = 0;
+#ifdef ENABLE_HTTP_PLUGIN
+        size_t own_selectors = 1;   // the http stub
+#else
+        size_t own_selectors = 0;
 #endif
+        chroutine_thread_t *idle = m_workers.find_if([own_selectors](chroutine_thread_t *thrd) {
+            return thrd->parked() && thrd->retirable(own_selectors);
+        });
+        if (idle) {
+            SPDLOG(INFO, "{}: retire worker {:p} of {}", __FUNCTION__, (void*)idle, count);
+            retire_worker(idle);
+        }
     }
 }
 
@@ -93,7 +215,9 @@ void engine_t::yield(int tick)
     if (pthrd == nullptr)
         return;
 
+    check_cancel();
     pthrd->yield(tick);
+    check_cancel();
 }
 
 void engine_t::wait(std::time_t wait_time_ms)
@@ -102,7 +226,9 @@ void engine_t::wait(std::time_t wait_time_ms)
     if (pthrd == nullptr)
         return;
 
+    check_cancel();
     pthrd->wait(wait_time_ms);
+    check_cancel();
 }
 
 void engine_t::sleep(std::time_t wait_time_ms)
@@ -111,24 +237,48 @@ void engine_t::sleep(std::time_t wait_time_ms)
     if (pthrd == nullptr)
         return;
 
+    check_cancel();
     pthrd->sleep(wait_time_ms);
+    check_cancel();
+}
+
+void engine_t::wait_us(std::time_t wait_time_us)
+{    
+    chroutine_thread_t *pthrd = get_current_thread();
+    if (pthrd == nullptr)
+        return;
+
+    check_cancel();
+    pthrd->wait_us(wait_time_us);
+    check_cancel();
 }
 
-chroutine_id_t engine_t::create_chroutine(func_t func, void *arg)
+void engine_t::sleep_us(std::time_t wait_time_us)
+{    
+    chroutine_thread_t *pthrd = get_current_thread();
+    if (pthrd == nullptr)
+        return;
+
+    check_cancel();
+    pthrd->sleep_us(wait_time_us);
+    check_cancel();
+}
+
+chroutine_id_t engine_t::create_chroutine_by_task(task_t & func, void *arg, const chroutine_attr_t & attr)
 {    
     // check called in main thread
     // if (m_main_thread_id != std::this_thread::get_id()) {
     //     SPDLOG(ERROR, "{} error: not called in main thread!", __FUNCTION__);
     //     return INVALID_ID;
     // }
-    chroutine_thread_t *pthrd = get_lightest_thread();
+    chroutine_thread_t *pthrd = get_placement_thread(attr);
     if (pthrd == nullptr)
         return INVALID_ID;
 
-    return pthrd->create_chroutine(func, arg);
+    return pthrd->create_chroutine(func, arg, attr);
 }
 
-chroutine_id_t engine_t::create_chroutine_in_mainthread(func_t func, void *arg)
+chroutine_id_t engine_t::create_chroutine_in_mainthread(task_t func, void *arg)
 {
     if (m_main_thread)
         return m_main_thread->create_chroutine(func, arg);        
@@ -136,10 +286,10 @@ chroutine_id_t engine_t::create_chroutine_in_mainthread(func_t func, void *arg)
     return INVALID_ID;
 }
 
-reporter_base_t * engine_t::create_son_chroutine(func_t func, const reporter_sptr_t & reporter, std::time_t timeout_ms)
+reporter_base_t * engine_t::create_son_chroutine_by_task(task_t & func, const reporter_sptr_t & reporter, std::time_t timeout_ms, const chroutine_attr_t & attr)
 {
     if (timeout_ms == 0) {
-        create_son_chroutine(func, nullptr);
+        create_son_chroutine_by_task(func, nullptr, attr);
         return nullptr;
     }
 
@@ -147,21 +297,31 @@ reporter_base_t * engine_t::create_son_chroutine(func_t func, const reporter_spt
     if (pthrd == nullptr)
         return nullptr;
 
-    pthrd->create_son_chroutine(func, reporter);
+    // the son runs under a token of its own with the deadline, cancelled if the wait times out
+    chroutine_attr_t son_attr = attr;
+    son_attr.token = attr.token.valid() ? attr.token.child(timeout_ms) : cancel_token_t::create(timeout_ms);
+
+    check_cancel();
+    pthrd->create_son_chroutine(func, reporter, son_attr);
     pthrd->wait(timeout_ms);
+    check_cancel();
     return pthrd->get_current_reporter();
 }
 
-chroutine_id_t engine_t::create_son_chroutine(func_t func, void *arg)
+chroutine_id_t engine_t::create_son_chroutine_by_task(task_t & func, void *arg, const chroutine_attr_t & attr)
 {
     chroutine_thread_t *pthrd = get_current_thread();
     if (pthrd == nullptr)
         return INVALID_ID;
 
-    return pthrd->create_chroutine(func, arg);
+    chroutine_t *father = chroutine_thread_t::current_chroutine();
+    if (father == nullptr)
+        return pthrd->create_chroutine(func, arg, attr);
+
+    return pthrd->create_chroutine(func, arg, father->son_attr(attr));
 }
 
-chroutine_thread_t *engine_t::get_current_thread()
+chroutine_thread_t *engine_t::find_current_thread()
 {
     if (!m_init_over) {
         SPDLOG(ERROR, "{} failed: m_init_over FALSE", __FUNCTION__);
@@ -176,11 +336,9 @@ chroutine_thread_t *engine_t::get_current_thread()
         return m_epoll_thread.get();
     }
 
-    const auto& iter = m_pool.find(cur_id);
-    if (iter == m_pool.end())
-        return nullptr;
-
-    return iter->second.get();
+    return m_workers.find_if([&cur_id](chroutine_thread_t *thrd) {
+        return thrd->thread_id() == cur_id;
+    });
 }
 
 chroutine_thread_t *engine_t::get_thread_by_id(std::thread::id thread_id)
@@ -197,11 +355,9 @@ chroutine_thread_t *engine_t::get_thread_by_id(std::thread::id thread_id)
         return m_epoll_thread.get();
     }
     
-    const auto& iter = m_pool.find(thread_id);
-    if (iter == m_pool.end())
-        return nullptr;
-
-    return iter->second.get();
+    return m_workers.find_if([&thread_id](chroutine_thread_t *thrd) {
+        return thrd->thread_id() == thread_id;
+    });
 }
 
 chroutine_thread_t *engine_t::get_lightest_thread()
@@ -211,11 +367,109 @@ chroutine_thread_t *engine_t::get_lightest_thread()
         return nullptr;
     }
 
-    if (m_creating.empty())
+    size_t count = m_workers.size();
+    if (count == 0)
         return nullptr;
 
-    // let's return a random one for test
-    return m_creating[m_dispatch_seed++ % m_creating.size()].get();
+    // power of two choices: the less loaded of two random ones,
+    // almost as good as scanning all, and no herd on the same least loaded one
+    static thread_local uint32_t seed = static_cast<uint32_t>(std::hash<std::thread::id>()(std::this_thread::get_id())) | 1;
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    size_t first_index = seed % count;
+    size_t second_index = count == 1 ? first_index : (first_index + 1 + (seed >> 16) % (count - 1)) % count;
+
+    // on the node of the caller: the nearest ones from the two random places
+    int node = m_numa_local ? caller_node() : -1;
+    if (node >= 0) {
+        chroutine_thread_t *first = worker_on_node(first_index, node, nullptr);
+        if (first) {
+            chroutine_thread_t *second = worker_on_node(second_index, node, first);
+            if (second == nullptr)
+                return first;
+            return second->pressure() < first->pressure() ? second : first;
+        }
+    }
+
+    chroutine_thread_t *first = m_workers.at(first_index);
+    if (count == 1 || first == nullptr)
+        return first ? first : get_least_loaded_thread();
+
+    // a different one, it may be just retired
+    chroutine_thread_t *second = m_workers.at(second_index);
+    if (second == nullptr)
+        return first;
+    return second->pressure() < first->pressure() ? second : first;
+}
+
+int engine_t::caller_node()
+{
+    chroutine_thread_t *pthrd = chroutine_thread_t::current();
+    if (pthrd && pthrd->node() >= 0)
+        return pthrd->node();
+    return cpu_topology_t::current_node();
+}
+
+chroutine_thread_t *engine_t::worker_on_node(size_t start, int node, chroutine_thread_t *except)
+{
+    size_t count = m_workers.size();
+    for (size_t i = 0; i < count; i++) {
+        chroutine_thread_t *thrd = m_workers.at((start + i) % count);
+        if (thrd && thrd != except && thrd->node() == node)
+            return thrd;
+    }
+    return nullptr;
+}
+
+chroutine_thread_t *engine_t::get_least_loaded_thread()
+{
+    if (!m_init_over) {
+        SPDLOG(ERROR, "{} failed: m_init_over FALSE", __FUNCTION__);
+        return nullptr;
+    }
+
+    chroutine_thread_t *least = nullptr;
+    float least_pressure = 0;
+    m_workers.find_if([&least, &least_pressure](chroutine_thread_t *thrd) {
+        float pressure = thrd->pressure();
+        if (least == nullptr || pressure < least_pressure) {
+            least = thrd;
+            least_pressure = pressure;
+        }
+        return false;
+    });
+    return least;
+}
+
+chroutine_thread_t *engine_t::get_placement_thread(const chroutine_attr_t & attr)
+{
+    chroutine_thread_t *pthrd = nullptr;
+    switch (attr.placement) {
+    case placement_t::local:
+        pthrd = get_current_thread();
+        if (pthrd && pthrd->type() != thread_type_t::worker) {
+            // main thread is for runtime tasks only
+            pthrd = nullptr;
+        }
+        break;
+    case placement_t::least_loaded:
+        pthrd = get_least_loaded_thread();
+        break;
+    case placement_t::thread:
+        pthrd = get_thread_by_id(attr.thread_id);
+        if (pthrd == nullptr) {
+            SPDLOG(WARN, "{}: thread {} not found, placed by two choices", __FUNCTION__, readable_thread_id(attr.thread_id));
+        }
+        break;
+    default:
+        break;
+    }
+
+    if (pthrd == nullptr) {
+        pthrd = get_lightest_thread();
+    }
+    return pthrd;
 }
 
 reporter_base_t *engine_t::get_my_reporter()
@@ -258,17 +512,48 @@ int engine_t::unregister_select_obj(selectable_object_it *key, std::thread::id t
 }
 
 chroutine_id_t engine_t::get_current_chroutine_id()
+{
+    chroutine_t *co = chroutine_thread_t::current_chroutine();
+    if (co == nullptr)
+        return INVALID_ID;
+
+    return co->id();
+}
+
+bool engine_t::park(std::time_t timeout_ms)
 {
     chroutine_thread_t *pthrd = get_current_thread();
     if (pthrd == nullptr)
-        return INVALID_ID;
+        return false;
+
+    check_cancel();
+    bool unparked = pthrd->park_current(timeout_ms > 0 ? (mono_clock_t::cached_ms() + timeout_ms) * 1000 : 0);
+    check_cancel();
+    return unparked;
+}
+
+void engine_t::hold()
+{
+    while (park()) {
+    }
+}
+
+int engine_t::unpark(chroutine_id_t id)
+{
+    // the thread owning it now, it may have been resettled
+    chroutine_thread_t *pthrd = chroutine_table_t::owner(id);
+    if (pthrd == nullptr)
+        return -1;
 
-    return pthrd->get_running_id();
+    return pthrd->unpark_chroutine(id);
 }
 
 int engine_t::awake_chroutine(chroutine_id_t id)
 {
-    chroutine_thread_t *pthrd = get_current_thread();
+    // the thread owning it now, it may have been resettled
+    chroutine_thread_t *pthrd = chroutine_table_t::owner(id);
+    if (pthrd == nullptr)
+        pthrd = get_current_thread();
     if (pthrd == nullptr)
         return -1;
 
@@ -276,16 +561,86 @@ int engine_t::awake_chroutine(chroutine_id_t id)
 }
 
 
+int engine_t::get_overruns(chroutine_id_t id)
+{
+    chroutine_thread_t *pthrd = chroutine_table_t::owner(id);
+    if (pthrd == nullptr)
+        return -1;
+
+    return pthrd->get_overruns(id);
+}
+
+uint64_t engine_t::total_overruns()
+{
+    uint64_t total = 0;
+    m_workers.find_if([&total](chroutine_thread_t *thrd) {
+        total += thrd->overruns();
+        return false;
+    });
+    return total;
+}
+
+void engine_t::start_watchdog()
+{
+    std::thread thrd([this] {
+        std::time_t last_check = mono_clock_t::now_ms();
+        std::time_t last_pool_check = last_check;
+        size_t blocked = 0;
+        while (!m_stopping) {
+            int check_ms = m_check_ms.load();
+            thread_ms_sleep(check_ms < SLICE_CHECK_MS ? check_ms : SLICE_CHECK_MS);
+            std::time_t now = mono_clock_t::now_ms();
+            m_workers.find_if([now](chroutine_thread_t *worker) {
+                worker->check_slice(now);
+                return false;
+            });
+
+            if (now - last_check >= check_ms) {
+                last_check = now;
+                blocked = check_threads(now);
+            }
+            if (now - last_pool_check >= POOL_CHECK_MS) {
+                last_pool_check = now;
+                balance_pool(blocked);
+            }
+        }
+    });
+    thrd.detach();
+}
+
 // awake waiting chroutine
 int engine_t::awake_chroutine(std::thread::id thread_id, chroutine_id_t id)
 {
-    chroutine_thread_t *pthrd = get_thread_by_id(thread_id);
+    // @thread_id may be stale if it was resettled
+    chroutine_thread_t *pthrd = chroutine_table_t::owner(id);
+    if (pthrd == nullptr)
+        pthrd = get_thread_by_id(thread_id);
     if (pthrd == nullptr)
         return -1;
 
     return pthrd->awake_chroutine(id);
 }
 
+int engine_t::awake_chroutines(std::thread::id thread_id, const std::vector<chroutine_id_t> & ids)
+{
+    chroutine_thread_t *pthrd = get_thread_by_id(thread_id);
+    if (pthrd == nullptr)
+        return -1;
+
+    pthrd->awake_chroutines(ids.data(), ids.size());
+    return 0;
+}
+
+
+void engine_t::enable_stack_painting(bool on)
+{
+    stack_pool_t::set_painting(on);
+}
+
+stack_usage_map_t engine_t::stack_usage()
+{
+    return stack_pool_t::usage();
+}
 
 #ifdef ENABLE_HTTP_PLUGIN
 std::shared_ptr<curl_rsp_t> engine_t::exec_curl(const std::string & url
@@ -299,13 +654,20 @@ std::shared_ptr<curl_rsp_t> engine_t::exec_curl(const std::string & url
         return nullptr;
     }
     
-    const auto& iter = m_http_stubs.find(std::this_thread::get_id());
-    if (iter == m_http_stubs.end()){
+    selectable_object_sptr_t stub_ptr;
+    {
+        std::lock_guard<std::mutex> http_lock(m_http_lock);
+        const auto& iter = m_http_stubs.find(std::this_thread::get_id());
+        if (iter != m_http_stubs.end()) {
+            stub_ptr = iter->second;
+        }
+    }
+    if (!stub_ptr) {
         SPDLOG(ERROR, "{} failed: cant find http_stub", __FUNCTION__);
         return nullptr;
     }
 
-    curl_stub_t *stub = static_cast<curl_stub_t *>(iter->second.get());
+    curl_stub_t *stub = static_cast<curl_stub_t *>(stub_ptr.get());
     if (stub == nullptr) {
         SPDLOG(ERROR, "{} failed: curl_stub_t * is nullptr", __FUNCTION__);
         return nullptr;
@@ -315,54 +677,148 @@ std::shared_ptr<curl_rsp_t> engine_t::exec_curl(const std::string & url
 }
 #endif
 
-void engine_t::check_threads()
+size_t engine_t::steal_chroutines(chroutine_thread_t *thief)
 {
-    std::time_t now = get_time_stamp();
-    thread_vector_t goods;
-    thread_vector_t bads;
-    const float load_warning = 0.7;
-    for (auto it = m_pool.begin(); it != m_pool.end(); it++) {
-        auto &thrd = it->second;
+    size_t count = m_workers.size();
+    if (!m_init_over || count < 2)
+        return 0;
+
+    // start from different victims, so the thieves don't line up on the same one
+    size_t start = static_cast<size_t>(m_steal_seed.fetch_add(1, std::memory_order_relaxed)) % count;
+    std::vector<chroutine_ptr_t> stolen;
+    // from the same node first, the stacks of the others are remote
+    int node = m_numa_local ? thief->node() : -1;
+    for (int pass = (node >= 0 ? 0 : 1); pass < 2 && stolen.empty(); pass++) {
+        for (size_t i = 0; i < count && stolen.empty(); i++) {
+            chroutine_thread_t *victim = m_workers.at((start + i) % count);
+            if (victim && victim != thief && victim->state() == thread_state_t_running
+                && (pass == 1 || victim->node() == node)) {
+                victim->give_away(stolen, thief);
+            }
+        }
+    }
+
+    // they were taken from the tail, keep their order
+    for (auto iter = stolen.rbegin(); iter != stolen.rend(); iter++) {
+        thief->resettle(*iter);
+    }
+    if (!stolen.empty()) {
+        SPDLOG(DEBUG, "thread {:p} stole {} chroutines", (void*)thief, stolen.size());
+    }
+    return stolen.size();
+}
+
+void engine_t::wake_idle_worker(chroutine_thread_t *busy)
+{
+    if (m_parked_workers.load() <= 0)
+        return;
+
+    m_workers.find_if([busy](chroutine_thread_t *thrd) {
+        return thrd != busy && thrd->wake_idle();
+    });
+}
+
+size_t engine_t::check_threads(std::time_t now)
+{
+    std::vector<chroutine_thread_t *> goods;
+    std::vector<chroutine_thread_t *> bads;
+    std::time_t blocked_ms = m_blocked_ms.load();
+    size_t count = m_workers.size();
+    for (size_t i = 0; i < count; i++) {
+        chroutine_thread_t *thrd = m_workers.at(i);
         if (thrd) {
             std::time_t thrd_entry_time = thrd->entry_time();
             if (thrd_entry_time != 0) {
                 SPDLOG(TRACE, "engine_t::check_thread: {:p}, entry time: {}, , now time: {}"
-                    , (void*)(thrd.get())
+                    , (void*)(thrd)
                     , thrd_entry_time
                     , now);
             }
 
-            if (thrd_entry_time != 0 && now > MAX_ENTRY_CALL_TIME_MS + thrd_entry_time) {
-                if (thread_state_t_running == thrd->state()) {
-                    bads.push_back(thrd);
-                }
+            if (thrd_entry_time != 0 && now > blocked_ms + thrd_entry_time) {
+                // the ones still blocked are checked again, for the chroutines came after
+                bads.push_back(thrd);
             } else {
                 if (thread_state_t_blocking == thrd->state()) {
                     thrd->set_state(thread_state_t_running); //TODO: more smart
-                } else {
+                    on_recovered(thrd, now);
+                } else if (thread_state_t_running == thrd->state()) {
                     goods.push_back(thrd);
                 }
             }
-
-            float load = thrd->load();
-            if (load > load_warning) {
-                SPDLOG(WARN, "engine_t::check_thread: {:p}, load warning: {} !", (void*)(thrd.get()), load);
-            }
         }
     }
 
     if (bads.size() > 0) {
-        size_t goodsize = goods.size();
-        if (goodsize == 0) {
+        if (goods.empty()) {
             SPDLOG(CRITICAL, "threads need switch, but no good threads left!!!");
-            return;
         }
-
-        int goodindex = 0;
         for (auto &bad : bads) {
-            bad->move_chroutines_to_thread(goods[goodindex++ % goodsize]);
+            bool found = thread_state_t_running == bad->state();
+            size_t moved = goods.empty() ? 0 : bad->move_chroutines_to_thread(goods);
+            if (found) {
+                on_blocked(bad, now, moved);
+            }
         }
     }
+    return bads.size();
+}
+
+std::vector<chroutine_thread_t *> engine_t::healthy_workers()
+{
+    std::vector<chroutine_thread_t *> healthy;
+    m_workers.find_if([&healthy](chroutine_thread_t *thrd) {
+        if (thrd->state() == thread_state_t_running) {
+            healthy.push_back(thrd);
+        }
+        return false;
+    });
+    return healthy;
+}
+
+void engine_t::on_blocked(chroutine_thread_t *thrd, std::time_t now, size_t moved)
+{
+    blocked_event_t event;
+    event.thread_id = thrd->thread_id();
+    event.chroutine = thrd->blocker(event.tag);
+    event.since = thrd->entry_time();
+    event.found = now;
+    event.moved = moved;
+    m_blocked_count++;
+    SPDLOG(WARN, "thread {:p} blocked by chroutine({}) tag '{}' for {} ms, {} chroutines moved"
+        , (void*)thrd, event.chroutine, event.tag, now - event.since, moved);
+
+    std::lock_guard<std::mutex> lck (m_events_lock);
+    m_blocked_events.push_back(event);
+    if (m_blocked_events.size() > MAX_BLOCKED_EVENTS) {
+        m_blocked_events.pop_front();
+    }
+}
+
+void engine_t::on_recovered(chroutine_thread_t *thrd, std::time_t now)
+{
+    std::lock_guard<std::mutex> lck (m_events_lock);
+    for (auto it = m_blocked_events.rbegin(); it != m_blocked_events.rend(); it++) {
+        if (it->thread_id == thrd->thread_id()) {
+            if (it->blocked_ms == 0) {
+                it->blocked_ms = now - it->since;
+                SPDLOG(INFO, "thread {:p} recovered after {} ms", (void*)thrd, it->blocked_ms);
+            }
+            break;
+        }
+    }
+}
+
+void engine_t::set_watchdog(const watchdog_config_t & config)
+{
+    m_check_ms = config.check_ms < 1 ? 1 : config.check_ms;
+    m_blocked_ms = config.blocked_ms < 1 ? 1 : config.blocked_ms;
+}
+
+std::vector<blocked_event_t> engine_t::blocked_events()
+{
+    std::lock_guard<std::mutex> lck (m_events_lock);
+    return std::vector<blocked_event_t>(m_blocked_events.begin(), m_blocked_events.end());
 }
 
 void engine_t::stop_main()
@@ -388,12 +844,16 @@ void engine_t::stop_main()
 
 void engine_t::stop_all()
 {
+    m_stopping = true;
     // stop pool
-    for (auto it = m_pool.begin(); it != m_pool.end(); it++) {
-        auto &thrd = it->second;
-        if (thrd) {
+    {
+        std::lock_guard<std::mutex> lck (m_pool_lock);
+        for (auto &thrd : m_threads) {
             thrd->stop();
         }
+        for (auto &retired : m_retired) {
+            retired.thread->stop();
+        }
     }
     // todo: join
 
@@ -419,14 +879,6 @@ void engine_t::run()
     m_main_thread->update_thread_id();
     SPDLOG(DEBUG, "main thread is about to run, check the id:{}", readable_thread_id(m_main_thread->thread_id()));
 
-    create_chroutine_in_mainthread([this](void *){
-        while (true) {
-            // max error value ENTRY_CALL_CHECK_TIMER_MS
-            m_main_thread->sleep(ENTRY_CALL_CHECK_TIMER_MS);
-            check_threads();
-        }        
-    }, nullptr);
-
     // async logger flush
 #ifdef DEBUG_BUILD
     uint32_t flush_timer_ms = 500;
@@ -10,10 +10,13 @@
 #define ENGINE_H
 
 #include <map>
+#include <deque>
 #include <vector>
 #include "tools.hpp"
 #include "chroutine.hpp"
 #include "selectable_obj.hpp"
+#include "thread_registry.hpp"
+#include "cpu_topology.hpp"
 
 #ifdef ENABLE_HTTP_PLUGIN
 #include "curl_stub.hpp"
@@ -28,16 +31,60 @@
 #define YIELD() {ENGIN.yield();}
 #define WAIT(t) {ENGIN.wait(t);}
 #define SLEEP(t) {ENGIN.sleep(t);}
-#define HOLD() {ENGIN.sleep(0xDC46C32800);}
+#define WAIT_US(t) {ENGIN.wait_us(t);}
+#define SLEEP_US(t) {ENGIN.sleep_us(t);}
+#define PREEMPT_POINT() {ENGIN.preempt_point();}
+#define HOLD() {ENGIN.hold();}
 
 namespace chr {
 
-typedef std::map<std::thread::id, std::shared_ptr<chroutine_thread_t> > thread_pool_t;
 typedef std::vector<std::shared_ptr<chroutine_thread_t> > thread_vector_t;
 #ifdef ENABLE_HTTP_PLUGIN
 typedef std::map<std::thread::id, selectable_object_sptr_t > http_stub_pool_t;
 #endif
 
+const size_t MAX_WORKERS = 256;
+const size_t MAX_BLOCKED_EVENTS = 64;   // the latest ones kept for engine_t::blocked_events
+
+// how the watchdog finds the blocked workers.
+// a worker is blocked when one chroutine runs on it for blocked_ms without switching out,
+// its other chroutines are moved to the healthy workers then.
+typedef struct watchdog_config_t {
+    int     check_ms = 250;         // check every check_ms, 1 at least
+    int     blocked_ms = 500;       // it may be found blocked up to check_ms later
+} watchdog_config_t;
+
+// a worker found blocked by the watchdog
+typedef struct blocked_event_t {
+    std::thread::id thread_id;
+    chroutine_id_t  chroutine = INVALID_ID; // the one blocking it
+    std::string     tag;                    // of the chroutine, see chroutine_attr_t::tag
+    std::time_t     since = 0;              // when the chroutine began running, ms of mono_clock_t
+    std::time_t     found = 0;              // when the watchdog found it, ms of mono_clock_t
+    std::time_t     blocked_ms = 0;         // how long it was blocked, 0 if it still is
+    size_t          moved = 0;              // the chroutines moved away
+} blocked_event_t;
+
+// how the worker pool grows and shrinks, checked by the watchdog every 250 ms.
+// the gap between the two conditions (and the check counts) is the hysteresis,
+// so the pool doesn't flap around a load level.
+typedef struct pool_config_t {
+    size_t  min_workers = 1;
+    size_t  max_workers = 1;        // no more than MAX_WORKERS
+
+    // grow when no worker is idle and the average pressure (see chroutine_thread_t::pressure)
+    // stays above grow_pressure for grow_checks checks in a row, or at once when the blocked
+    // workers leave less than min_workers.
+    float   grow_pressure = 2.0;
+    int     grow_checks = 3;
+
+    // retire one idle worker when at least 2 were idle for shrink_checks checks in a row
+    int     shrink_checks = 20;
+
+    // pin the threads to cpus, not pinned by default
+    affinity_config_t   affinity;
+} pool_config_t;
+
 
 class chr_timer_t;
 class engine_t final
@@ -48,7 +95,22 @@ public:
     ~engine_t();
 
     // start all thread, will block your thread until they are ready !!!
+    // the pool size is fixed.
     void init(size_t init_pool_size);
+
+    // start min_workers threads, and let the pool grow and shrink by @config
+    void init(const pool_config_t & config);
+
+    // the workers running now
+    size_t worker_count() {
+        return m_workers.size();
+    }
+
+    // the workers parked for lack of work now, they steal from the busy ones when kicked
+    size_t idle_worker_count() {
+        int parked = m_parked_workers.load();
+        return parked > 0 ? parked : 0;
+    }
     
     // yield myself by thread loop tick count
     void yield(int tick = 1);
@@ -60,20 +122,39 @@ public:
     // yield myself for some time, 
     // we should always use this instead of system sleep() !!!
     void sleep(std::time_t wait_time_ms);
+
+    // wait() and sleep() in us, for pacing below 1 ms
+    void wait_us(std::time_t wait_time_us);
+    void sleep_us(std::time_t wait_time_us);
     
     // create and run a chroutine in the lightest thread.
-    chroutine_id_t create_chroutine(func_t func, void *arg);
+    // @func is any callable taking `void *` (@arg is passed) or nothing,
+    // it's stored in the chroutine without allocating if it's small enough (see task_t).
+    template<typename F>
+    chroutine_id_t create_chroutine(F && func, void *arg, const chroutine_attr_t & attr = chroutine_attr_t()) {
+        task_t task(std::forward<F>(func));
+        return create_chroutine_by_task(task, arg, attr);
+    }
 
     // create and run a son chroutine for the current chroutine.
     // returns the son's result so the father can get what he want.
     // @timeout_ms controls the max time for the son to run, 
     // if @timeout_ms is 0, that means father won't wait any time and doesn't care the result of son.
-    reporter_base_t * create_son_chroutine(func_t func, const reporter_sptr_t & reporter, std::time_t timeout_ms);
+    // the son is cancelled when the time is out, see cancel.hpp.
+    template<typename F>
+    reporter_base_t * create_son_chroutine(F && func, const reporter_sptr_t & reporter, std::time_t timeout_ms, const chroutine_attr_t & attr = chroutine_attr_t()) {
+        task_t task(std::forward<F>(func));
+        return create_son_chroutine_by_task(task, reporter, timeout_ms, attr);
+    }
     
     // called in a chroutine.
     // just start another chroutin in the same thread, 
     // father won't wait any time and doesn't care the result of son.
-    chroutine_id_t create_son_chroutine(func_t func, void *arg);
+    template<typename F>
+    chroutine_id_t create_son_chroutine(F && func, void *arg, const chroutine_attr_t & attr = chroutine_attr_t()) {
+        task_t task(std::forward<F>(func));
+        return create_son_chroutine_by_task(task, arg, attr);
+    }
 
     // register a select object to current thread
     int register_select_obj(const selectable_object_sptr_t & select_obj, std::thread::id thread_id);
@@ -84,12 +165,93 @@ public:
     // get my chroutine id
     chroutine_id_t get_current_chroutine_id();
 
+    // switch out the current chroutine if it ran over MAX_RUN_MS_EACH, cheap if not.
+    // call it in long computing loops which never yield.
+    // it's also a suspension point: it throws chroutine_cancelled_t if cancelled.
+    void preempt_point() {
+        chroutine_thread_t *pthrd = chroutine_thread_t::current();
+        if (pthrd) {
+            pthrd->preempt_point();
+            check_cancel();
+        }
+    }
+
+    // whether the current chroutine is cancelled, or its deadline passed, see cancel.hpp
+    bool cancelled() {
+        // a computing loop calls it without switching out, nobody refreshes the cached time for it
+        mono_clock_t::now_us();
+        chroutine_t *co = chroutine_thread_t::current_chroutine();
+        return co && co->get_token().cancelled();
+    }
+
+    // throw chroutine_cancelled_t if the current chroutine is cancelled.
+    // every suspension point calls it, before and after switching out.
+    // not thrown while unwinding or in a cancel_shield_t, so cleaning up may still yield or sleep.
+    void check_cancel() {
+        chroutine_t *co = chroutine_thread_t::current_chroutine();
+        if (co == nullptr || !co->get_token().valid() || co->cancel_shielded()) {
+            return;
+        }
+        cancel_reason_t reason = co->get_token().reason();
+        if (reason != cancel_none && !std::uncaught_exception()) {
+            throw chroutine_cancelled_t(reason);
+        }
+    }
+
+    // the token the current chroutine runs under, empty if none.
+    // pass it to other chroutines (chroutine_attr_t::token), so they are cancelled with it.
+    cancel_token_t current_token() {
+        chroutine_t *co = chroutine_thread_t::current_chroutine();
+        return co ? co->get_token() : cancel_token_t();
+    }
+
+    // how many times chroutine @id ran over MAX_RUN_MS_EACH, -1 if not found
+    int get_overruns(chroutine_id_t id);
+
+    // overruns of all chroutines on the workers
+    uint64_t total_overruns();
+
+    // park the current chroutine until it's unparked, or @timeout_ms passes (0: never).
+    // a parked chroutine costs nothing until it's woken.
+    // return true if it was unparked, false if timed out or awaken by awake_chroutine,
+    // so check what you wait for again.
+    bool park(std::time_t timeout_ms = 0);
+
+    // park the current chroutine until it's awaken by awake_chroutine (or cancelled).
+    // unparks don't end it: one may be left by a waker too late for a timed out wait.
+    void hold();
+
+    // unpark chroutine @id from any thread.
+    // if it's not parked now, its next park() returns at once, so no unpark is lost.
+    int unpark(chroutine_id_t id);
+
     // awake waiting chroutine
     int awake_chroutine(chroutine_id_t id);
     
     // awake waiting chroutine
     int awake_chroutine(std::thread::id thread_id, chroutine_id_t id);
 
+    // awake waiting chroutines of a thread in one batch
+    int awake_chroutines(std::thread::id thread_id, const std::vector<chroutine_id_t> & ids);
+
+    // paint the stacks of new chroutines to measure their usage, off by default.
+    // painting touches every page of the stack, turn it on for measurement only.
+    void enable_stack_painting(bool on);
+
+    // stack usage of the finished chroutines (painted only), aggregated by tag
+    stack_usage_map_t stack_usage();
+
+    // set the thresholds of the watchdog, at any time
+    void set_watchdog(const watchdog_config_t & config);
+
+    // the latest MAX_BLOCKED_EVENTS workers found blocked, the oldest first
+    std::vector<blocked_event_t> blocked_events();
+
+    // how many times the workers were found blocked
+    uint64_t blocked_count() {
+        return m_blocked_count.load();
+    }
+
     // the main thread
     void run();
 
@@ -119,9 +281,24 @@ public:
 
 private:    
     engine_t();
-    void on_thread_ready(size_t creating_index, std::thread::id thread_id);
-    chroutine_thread_t *get_current_thread();
+    void on_thread_ready(chroutine_thread_t *thrd);
+    // the thread scheduling here, looked up only if it's not a chroutine thread
+    chroutine_thread_t *get_current_thread() {
+        chroutine_thread_t *pthrd = chroutine_thread_t::current();
+        return pthrd ? pthrd : find_current_thread();
+    }
+    chroutine_thread_t *find_current_thread();
     chroutine_thread_t *get_lightest_thread();
+
+    // the NUMA node of the calling thread
+    int caller_node();
+
+    // the first worker on @node from the @start index, except @except
+    chroutine_thread_t *worker_on_node(size_t start, int node, chroutine_thread_t *except);
+    chroutine_thread_t *get_least_loaded_thread();
+
+    // the thread for a new chroutine, see placement_t
+    chroutine_thread_t *get_placement_thread(const chroutine_attr_t & attr);
     chroutine_thread_t *get_thread_by_id(std::thread::id thread_id);    
     
     // get current chroutine's reporter
@@ -130,19 +307,69 @@ private:
     
     // create and run a chroutine in the main thread.
     // main thread is for runtime tasks only
-    chroutine_id_t create_chroutine_in_mainthread(func_t func, void *arg);
+    chroutine_id_t create_chroutine_in_mainthread(task_t func, void *arg);
+
+    // the callable was wrapped by the templates above
+    chroutine_id_t create_chroutine_by_task(task_t & func, void *arg, const chroutine_attr_t & attr);
+    reporter_base_t * create_son_chroutine_by_task(task_t & func, const reporter_sptr_t & reporter, std::time_t timeout_ms, const chroutine_attr_t & attr);
+    chroutine_id_t create_son_chroutine_by_task(task_t & func, void *arg, const chroutine_attr_t & attr);
+
+    // check threads availability, return the count blocked.
+    // if thread was block, spread its chroutines over the good ones
+    size_t check_threads(std::time_t now);
+
+    // the workers running and not blocked
+    std::vector<chroutine_thread_t *> healthy_workers();
+
+    // record @thrd found blocked, or mark its latest event over
+    void on_blocked(chroutine_thread_t *thrd, std::time_t now, size_t moved);
+    void on_recovered(chroutine_thread_t *thrd, std::time_t now);
+
+    // move some ready chroutines of other workers to @thief, return the count
+    size_t steal_chroutines(chroutine_thread_t *thief);
+
+    // kick a parked worker (except @busy) to steal from @busy
+    void wake_idle_worker(chroutine_thread_t *busy);
 
-    // check threads availability
-    // if thread was block, move it to a good one
-    void check_threads();
+    // an os thread checking the time slices of the workers (see chroutine_thread_t::check_slice),
+    // the blocked workers and the pool size. it's not delayed by a busy main thread.
+    void start_watchdog();
+
+    // start a new worker, it's published to m_workers when it's ready
+    void add_worker();
+
+    // unpublish @thrd and let it hand its chroutines over and exit
+    void retire_worker(chroutine_thread_t *thrd);
+
+    // grow or shrink the pool by m_config, @blocked workers were found by check_threads
+    void balance_pool(size_t blocked);
 
 private:
-    std::mutex          m_pool_lock;            // only used during m_init_over is false
-    thread_pool_t       m_pool;                 // is readonly after m_init_over become true
-    thread_vector_t     m_creating;             // is readonly after m_init_over become true
+    typedef struct retired_t {
+        std::shared_ptr<chroutine_thread_t> thread;
+        std::time_t                         since;
+    } retired_t;
+
+    std::mutex          m_pool_lock;            // guards m_threads and m_retired
+    thread_vector_t     m_threads;              // the workers started and not retired
+    std::vector<retired_t>  m_retired;          // kept alive for readers who got them from m_workers
+    thread_registry_t<chroutine_thread_t, MAX_WORKERS>  m_workers;  // the ready workers, read lock free
+    pool_config_t       m_config;
+    int                 m_grow_streak = 0;      // checks in a row wanting to grow
+    int                 m_shrink_streak = 0;    // checks in a row wanting to shrink
+    size_t              m_next_cpu = 0;         // the next in affinity.worker_cpus
+    bool                m_numa_local = false;   // prefer the workers on the node of the caller
     bool                m_init_over = false;    // if all threads ready
-    int                 m_dispatch_seed = 0;
+    std::atomic<int>    m_steal_seed{0};
+    std::atomic<int>    m_parked_workers{0};    // the workers waiting for a kick
+    std::atomic<bool>   m_stopping{false};
+    std::atomic<int>    m_check_ms{250};        // see watchdog_config_t
+    std::atomic<int>    m_blocked_ms{500};
+    std::mutex          m_events_lock;          // guards m_blocked_events
+    std::deque<blocked_event_t>  m_blocked_events;
+    std::atomic<uint64_t>        m_blocked_count{0};
 #ifdef ENABLE_HTTP_PLUGIN
+    std::mutex          m_http_lock;
     http_stub_pool_t    m_http_stubs;
 #endif
     std::shared_ptr<chroutine_thread_t>     m_main_thread = nullptr;
@@ -153,5 +380,29 @@ private:
     chr_timer_t*        m_flush_timer;
 };
 
+// in its scope, the suspension points of the current chroutine don't throw
+// chroutine_cancelled_t, for cleaning up a cancelled one which must still wait.
+class cancel_shield_t final
+{
+public:
+    cancel_shield_t() : m_co(chroutine_thread_t::current_chroutine()) {
+        if (m_co) {
+            m_co->shield_cancel(1);
+        }
+    }
+    ~cancel_shield_t() {
+        if (m_co) {
+            m_co->shield_cancel(-1);
+        }
+    }
+
+private:
+    cancel_shield_t(const cancel_shield_t&) = delete;
+    cancel_shield_t& operator=(const cancel_shield_t&) = delete;
+
+private:
+    chroutine_t *   m_co;
+};
+
 }
 #endif
\ No newline at end of file
@@ -0,0 +1,473 @@
+/// \file future.hpp
+///
+/// promise_t<T> and future_t<T> pass one value from whoever makes it
+/// (a son chroutine, another worker, a gRPC or curl callback, any thread)
+/// to whoever waits for it.
+///
+/// a chroutine waiting on a future is parked and unparked by the completion directly,
+/// a plain thread waits on a condition variable.
+/// when_all and when_any combine futures by hooking on their completions,
+/// no chroutine is spawned to wait for them.
+///
+/// \author ingangi
+/// \version 0.1.0
+/// \date 2026-10-17
+
+#ifndef FUTURE_HPP
+#define FUTURE_HPP
+
+#include <new>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <functional>
+#include <type_traits>
+#include <condition_variable>
+#include "engine.hpp"
+
+namespace chr {
+
+// the state shared by a promise_t and its futures, without the value
+class future_state_base_t
+{
+public:
+    typedef std::function<void()> continuation_t;
+
+    virtual ~future_state_base_t() {}
+
+    bool ready() {
+        std::lock_guard<std::mutex> lock(m_lock);
+        return m_ready;
+    }
+
+    // the promise was dropped without a value
+    bool broken() {
+        std::lock_guard<std::mutex> lock(m_lock);
+        return m_ready && m_broken;
+    }
+
+    // wait till it's ready, or @timeout_ms passes (0: never), return whether it's ready
+    bool wait(std::time_t timeout_ms) {
+        std::time_t deadline = timeout_ms > 0 ? mono_clock_t::round_ms() + timeout_ms : 0;
+        chroutine_id_t me = ENGIN.get_current_chroutine_id();
+        if (me == INVALID_ID) {
+            return wait_thread(deadline);
+        }
+
+        std::unique_lock<std::mutex> lock(m_lock);
+        while (!m_ready) {
+            std::time_t left = 0;
+            if (deadline != 0) {
+                left = deadline - mono_clock_t::cached_ms();
+                if (left <= 0) {
+                    break;
+                }
+            }
+            m_waiters.push_back(me);
+            lock.unlock();
+            try {
+                ENGIN.park(left);
+            } catch (const chroutine_cancelled_t &) {
+                lock.lock();
+                remove_waiter(me);
+                throw;
+            }
+            lock.lock();
+            remove_waiter(me);
+        }
+        return m_ready;
+    }
+
+    // call @func when it's ready, by the completing thread, or right now if it's ready already.
+    // keep it short, it runs out of any chroutine maybe.
+    void then(const continuation_t & func) {
+        {
+            std::lock_guard<std::mutex> lock(m_lock);
+            if (!m_ready) {
+                m_continuations.push_back(func);
+                return;
+            }
+        }
+        func();
+    }
+
+protected:
+    // mark it ready and wake all waiters, false if it's ready already.
+    // @fill sets the value, called under the lock.
+    template<typename F>
+    bool complete(bool broken, F && fill) {
+        std::vector<chroutine_id_t> waiters;
+        std::vector<continuation_t> continuations;
+        {
+            std::lock_guard<std::mutex> lock(m_lock);
+            if (m_ready) {
+                return false;
+            }
+            fill();
+            m_ready = true;
+            m_broken = broken;
+            std::swap(waiters, m_waiters);
+            std::swap(continuations, m_continuations);
+            if (m_thread_waiters > 0) {
+                m_cond.notify_all();
+            }
+        }
+
+        for (auto id : waiters) {
+            ENGIN.unpark(id);
+        }
+        for (auto & func : continuations) {
+            func();
+        }
+        return true;
+    }
+
+private:
+    bool wait_thread(std::time_t deadline) {
+        std::unique_lock<std::mutex> lock(m_lock);
+        m_thread_waiters++;
+        while (!m_ready) {
+            if (deadline == 0) {
+                m_cond.wait(lock);
+                continue;
+            }
+            std::time_t left = deadline - mono_clock_t::now_ms();
+            if (left <= 0) {
+                break;
+            }
+            m_cond.wait_for(lock, std::chrono::milliseconds(left));
+        }
+        m_thread_waiters--;
+        return m_ready;
+    }
+
+    void remove_waiter(chroutine_id_t id) {
+        for (size_t i = 0; i < m_waiters.size(); i++) {
+            if (m_waiters[i] == id) {
+                m_waiters[i] = m_waiters.back();
+                m_waiters.pop_back();
+                return;
+            }
+        }
+    }
+
+protected:
+    std::mutex                  m_lock;
+    bool                        m_ready = false;
+    bool                        m_broken = false;
+
+private:
+    std::vector<chroutine_id_t> m_waiters;          // parked chroutines
+    std::vector<continuation_t> m_continuations;
+    std::condition_variable     m_cond;             // for plain threads
+    int                         m_thread_waiters = 0;
+};
+
+template<typename T>
+class future_state_t final : public future_state_base_t
+{
+public:
+    ~future_state_t() {
+        if (m_ready && !m_broken) {
+            value().~T();
+        }
+    }
+
+    template<typename V>
+    bool set(V && v) {
+        return complete(false, [&]() {
+            new (&m_value) T(std::forward<V>(v));
+        });
+    }
+
+    bool set_broken() {
+        return complete(true, [](){});
+    }
+
+    // only after it's ready and not broken
+    T & value() {
+        return *reinterpret_cast<T*>(&m_value);
+    }
+
+private:
+    typename std::aligned_storage<sizeof(T), alignof(T)>::type m_value;
+};
+
+template<>
+class future_state_t<void> final : public future_state_base_t
+{
+public:
+    bool set() {
+        return complete(false, [](){});
+    }
+
+    bool set_broken() {
+        return complete(true, [](){});
+    }
+};
+
+template<typename T> class promise_t;
+
+// the reading side, copyable, all copies see the same value
+template<typename T>
+class future_t
+{
+public:
+    typedef std::shared_ptr<future_state_t<T> > state_sptr_t;
+
+    future_t() {}
+
+    bool valid() const {
+        return m_state.get() != nullptr;
+    }
+
+    bool ready() const {
+        return valid() && m_state->ready();
+    }
+
+    // ready without a value, as its promise_t was dropped
+    bool broken() const {
+        return !valid() || m_state->broken();
+    }
+
+    // wait till it's ready, or @timeout_ms passes (0: never), return whether it's ready
+    bool wait(std::time_t timeout_ms = 0) const {
+        return valid() && m_state->wait(timeout_ms);
+    }
+
+    // wait for the value and copy it to @out, false if timed out or broken
+    bool get(T & out, std::time_t timeout_ms = 0) const {
+        if (!wait(timeout_ms) || m_state->broken()) {
+            return false;
+        }
+        out = m_state->value();
+        return true;
+    }
+
+    // wait for the value, T() if broken
+    T get() const {
+        T out = T();
+        get(out);
+        return out;
+    }
+
+    // call @func when it's ready, see future_state_base_t::then
+    void then(const std::function<void()> & func) const {
+        if (valid()) {
+            m_state->then(func);
+        }
+    }
+
+private:
+    friend class promise_t<T>;
+    explicit future_t(const state_sptr_t & state) : m_state(state) {}
+
+private:
+    state_sptr_t    m_state;
+};
+
+template<>
+class future_t<void>
+{
+public:
+    typedef std::shared_ptr<future_state_t<void> > state_sptr_t;
+
+    future_t() {}
+
+    bool valid() const {
+        return m_state.get() != nullptr;
+    }
+
+    bool ready() const {
+        return valid() && m_state->ready();
+    }
+
+    bool broken() const {
+        return !valid() || m_state->broken();
+    }
+
+    bool wait(std::time_t timeout_ms = 0) const {
+        return valid() && m_state->wait(timeout_ms);
+    }
+
+    // wait till it's done, false if timed out or broken
+    bool get(std::time_t timeout_ms = 0) const {
+        return wait(timeout_ms) && !m_state->broken();
+    }
+
+    void then(const std::function<void()> & func) const {
+        if (valid()) {
+            m_state->then(func);
+        }
+    }
+
+private:
+    friend class promise_t<void>;
+    explicit future_t(const state_sptr_t & state) : m_state(state) {}
+
+private:
+    state_sptr_t    m_state;
+};
+
+// the writing side, movable only. set it once from any thread,
+// dropping it without a value breaks its futures, so no waiter hangs.
+template<typename T>
+class promise_t final
+{
+public:
+    promise_t() : m_state(new future_state_t<T>()) {}
+    promise_t(promise_t && other) : m_state(std::move(other.m_state)) {}
+    promise_t& operator=(promise_t && other) {
+        if (this != &other) {
+            drop();
+            m_state = std::move(other.m_state);
+        }
+        return *this;
+    }
+    ~promise_t() {
+        drop();
+    }
+
+    future_t<T> get_future() const {
+        return future_t<T>(m_state);
+    }
+
+    // false if it's set already
+    template<typename V>
+    bool set_value(V && v) {
+        return m_state && m_state->set(std::forward<V>(v));
+    }
+
+private:
+    void drop() {
+        if (m_state) {
+            m_state->set_broken();
+        }
+    }
+
+    promise_t(const promise_t&) = delete;
+    promise_t& operator=(const promise_t&) = delete;
+
+private:
+    typename future_t<T>::state_sptr_t  m_state;
+};
+
+template<>
+class promise_t<void> final
+{
+public:
+    promise_t() : m_state(new future_state_t<void>()) {}
+    promise_t(promise_t && other) : m_state(std::move(other.m_state)) {}
+    promise_t& operator=(promise_t && other) {
+        if (this != &other) {
+            drop();
+            m_state = std::move(other.m_state);
+        }
+        return *this;
+    }
+    ~promise_t() {
+        drop();
+    }
+
+    future_t<void> get_future() const {
+        return future_t<void>(m_state);
+    }
+
+    bool set_value() {
+        return m_state && m_state->set();
+    }
+
+private:
+    void drop() {
+        if (m_state) {
+            m_state->set_broken();
+        }
+    }
+
+    promise_t(const promise_t&) = delete;
+    promise_t& operator=(const promise_t&) = delete;
+
+private:
+    future_t<void>::state_sptr_t    m_state;
+};
+
+// ready when all of @futures are ready (broken ones count), ready at once if it's empty
+template<typename T>
+future_t<void> when_all(const std::vector<future_t<T> > & futures) {
+    std::shared_ptr<promise_t<void> > all(new promise_t<void>());
+    future_t<void> result = all->get_future();
+    std::shared_ptr<std::atomic<size_t> > left(new std::atomic<size_t>(futures.size() + 1));
+    auto one_done = [all, left]() {
+        if (left->fetch_sub(1) == 1) {
+            all->set_value();
+        }
+    };
+    for (auto & f : futures) {
+        if (f.valid()) {
+            f.then(one_done);
+        } else {
+            one_done();
+        }
+    }
+    // the extra one, so it's not set while hooking
+    one_done();
+    return result;
+}
+
+// ready with the index of the first of @futures ready, broken if it's empty
+template<typename T>
+future_t<size_t> when_any(const std::vector<future_t<T> > & futures) {
+    std::shared_ptr<promise_t<size_t> > any(new promise_t<size_t>());
+    future_t<size_t> result = any->get_future();
+    for (size_t i = 0; i < futures.size(); i++) {
+        // the later ones fail to set it
+        futures[i].then([any, i]() {
+            any->set_value(i);
+        });
+        if (result.ready()) {
+            break;
+        }
+    }
+    return result;
+}
+
+namespace detail {
+
+template<typename R>
+struct async_call_t {
+    template<typename F>
+    static void call(F & func, promise_t<R> & promise) {
+        promise.set_value(func());
+    }
+};
+
+template<>
+struct async_call_t<void> {
+    template<typename F>
+    static void call(F & func, promise_t<void> & promise) {
+        func();
+        promise.set_value();
+    }
+};
+
+}
+
+// run @func in a new chroutine, its result is set to the future returned.
+// unlike a son chroutine, the caller waits for it or not, from any thread.
+template<typename F, typename R = typename std::result_of<F()>::type>
+future_t<R> async_chroutine(F && func, const chroutine_attr_t & attr = chroutine_attr_t()) {
+    typedef typename std::decay<F>::type func_t;
+    std::shared_ptr<promise_t<R> > promise(new promise_t<R>());
+    future_t<R> result = promise->get_future();
+    std::shared_ptr<func_t> call(new func_t(std::forward<F>(func)));
+    // if it's not created, the promise is dropped with the task, and the future is broken
+    ENGIN.create_chroutine([promise, call](void *) {
+        detail::async_call_t<R>::call(*call, *promise);
+    }, nullptr, attr);
+    return result;
+}
+
+}
+
+#endif
@@ -0,0 +1,243 @@
+/// \file handle_table.hpp
+///
+/// handle_table_t gives objects handles made of a slot index and a generation,
+/// so looking up an object by handle is an array index, and a stale handle
+/// (the object was gone, and the slot may be reused) is told by the generation.
+///
+/// each slot also keeps the owner of the object (e.g. the thread it runs on),
+/// so other threads can find where to send requests for a handle.
+///
+/// slots live in segments which are never freed, so any thread can read them.
+/// each os thread takes slot indexes from the global counter by blocks,
+/// and keeps the freed ones to reuse, so attaching doesn't contend.
+///
+/// \author ingangi
+/// \version 0.1.0
+/// \date 2026-10-17
+
+#ifndef HANDLE_TABLE_HPP
+#define HANDLE_TABLE_HPP
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <new>
+#include <mutex>
+#include <atomic>
+#include <vector>
+
+namespace chr {
+
+template<typename T, typename O>
+class handle_table_t final
+{
+    typedef struct slot_t {
+        std::atomic<T *>        obj;
+        std::atomic<O *>        owner;
+        std::atomic<uint32_t>   gen;
+    } slot_t;
+
+    static const int GEN_BITS = 24;
+    static const uint32_t GEN_MASK = (1u << GEN_BITS) - 1;
+    static const int SEGMENT_BITS = 12;
+    static const uint32_t SEGMENT_SIZE = 1u << SEGMENT_BITS;
+    static const uint32_t MAX_SEGMENTS = 1u << 16;
+    static const uint32_t BLOCK_SIZE = 256;
+
+    typedef struct global_t {
+        std::atomic<slot_t *>   segments[MAX_SEGMENTS];
+        std::atomic<uint32_t>   next_index;
+        std::mutex              spare_lock;
+        std::vector<uint32_t>   spare;      // freed by exited threads
+    } global_t;
+
+    // the free indexes of current thread, given to the spare when the thread exits
+    typedef struct local_t {
+        std::vector<uint32_t>   free;
+        bool                    exited = false;
+        ~local_t() {
+            exited = true;
+            give_spare(free);
+        }
+    } local_t;
+
+public:
+    // make a handle for @obj, never 0 or negative
+    static int64_t attach(T *obj, O *owner = nullptr) {
+        uint32_t index = alloc_index();
+        slot_t *slot = slot_of(index);
+        slot->owner.store(owner, std::memory_order_relaxed);
+        slot->obj.store(obj, std::memory_order_release);
+        return make_handle(index, slot->gen.load(std::memory_order_relaxed));
+    }
+
+    // the handle is stale since now, and its slot can be reused
+    static void detach(int64_t handle) {
+        slot_t *slot = find_slot(handle);
+        if (slot == nullptr) {
+            return;
+        }
+        // readers check the generation again after reading, so bump it first
+        slot->gen.store((gen_of(handle) + 1) & GEN_MASK, std::memory_order_release);
+        slot->obj.store(nullptr, std::memory_order_relaxed);
+        slot->owner.store(nullptr, std::memory_order_relaxed);
+        free_index(index_of(handle));
+    }
+
+    // the object of @handle, nullptr if the handle is stale
+    static T *get(int64_t handle) {
+        slot_t *slot = find_slot(handle);
+        if (slot == nullptr || slot->gen.load(std::memory_order_acquire) != gen_of(handle)) {
+            return nullptr;
+        }
+        T *obj = slot->obj.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (slot->gen.load(std::memory_order_relaxed) != gen_of(handle)) {
+            return nullptr;
+        }
+        return obj;
+    }
+
+    // the owner of @handle, nullptr if the handle is stale or not owned
+    static O *owner(int64_t handle) {
+        slot_t *slot = find_slot(handle);
+        if (slot == nullptr || slot->gen.load(std::memory_order_acquire) != gen_of(handle)) {
+            return nullptr;
+        }
+        O *owner = slot->owner.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (slot->gen.load(std::memory_order_relaxed) != gen_of(handle)) {
+            return nullptr;
+        }
+        return owner;
+    }
+
+    static void set_owner(int64_t handle, O *owner) {
+        slot_t *slot = find_slot(handle);
+        if (slot && slot->gen.load(std::memory_order_relaxed) == gen_of(handle)) {
+            slot->owner.store(owner, std::memory_order_release);
+        }
+    }
+
+private:
+    handle_table_t() = delete;
+
+    static global_t &global() {
+        // zero initialized before any use, as it's static
+        static global_t g;
+        return g;
+    }
+
+    static local_t *local() {
+        static thread_local local_t l;
+        return l.exited ? nullptr : &l;
+    }
+
+    static int64_t make_handle(uint32_t index, uint32_t gen) {
+        return (static_cast<int64_t>(index) << GEN_BITS) | gen;
+    }
+    static uint32_t index_of(int64_t handle) {
+        return static_cast<uint32_t>(handle >> GEN_BITS);
+    }
+    static uint32_t gen_of(int64_t handle) {
+        return static_cast<uint32_t>(handle) & GEN_MASK;
+    }
+
+    static slot_t *slot_of(uint32_t index) {
+        return global().segments[index >> SEGMENT_BITS].load(std::memory_order_acquire) + (index & (SEGMENT_SIZE - 1));
+    }
+
+    static slot_t *find_slot(int64_t handle) {
+        if (handle <= 0) {
+            return nullptr;
+        }
+        uint32_t index = index_of(handle);
+        if ((index >> SEGMENT_BITS) >= MAX_SEGMENTS) {
+            return nullptr;
+        }
+        slot_t *segment = global().segments[index >> SEGMENT_BITS].load(std::memory_order_acquire);
+        if (segment == nullptr) {
+            return nullptr;
+        }
+        return segment + (index & (SEGMENT_SIZE - 1));
+    }
+
+    static uint32_t alloc_index() {
+        local_t *l = local();
+        std::vector<uint32_t> spare_free;
+        std::vector<uint32_t> &free = l ? l->free : spare_free;
+        if (free.empty()) {
+            take_spare(free);
+        }
+        if (free.empty()) {
+            new_block(free);
+        }
+        uint32_t index = free.back();
+        free.pop_back();
+        if (l == nullptr) {
+            give_spare(free);
+        }
+        return index;
+    }
+
+    static void free_index(uint32_t index) {
+        local_t *l = local();
+        if (l) {
+            l->free.push_back(index);
+        } else {
+            std::vector<uint32_t> one(1, index);
+            give_spare(one);
+        }
+    }
+
+    static void new_block(std::vector<uint32_t> &free) {
+        global_t &g = global();
+        uint32_t first = g.next_index.fetch_add(BLOCK_SIZE, std::memory_order_relaxed);
+        if ((first >> SEGMENT_BITS) >= MAX_SEGMENTS) {
+            throw std::bad_alloc();
+        }
+
+        // blocks never cross segments, as SEGMENT_SIZE is a multiple of BLOCK_SIZE
+        std::atomic<slot_t *> &segment = g.segments[first >> SEGMENT_BITS];
+        if (segment.load(std::memory_order_acquire) == nullptr) {
+            slot_t *fresh = static_cast<slot_t *>(calloc(SEGMENT_SIZE, sizeof(slot_t)));
+            if (fresh == nullptr) {
+                throw std::bad_alloc();
+            }
+            slot_t *expected = nullptr;
+            if (!segment.compare_exchange_strong(expected, fresh, std::memory_order_acq_rel)) {
+                ::free(fresh);
+            }
+        }
+
+        // reversed, so they are used in order
+        for (uint32_t index = first + BLOCK_SIZE; index > first; index--) {
+            // 0 is not a valid handle
+            if (index - 1 != 0) {
+                free.push_back(index - 1);
+            }
+        }
+    }
+
+    static void take_spare(std::vector<uint32_t> &free) {
+        global_t &g = global();
+        std::lock_guard<std::mutex> lock(g.spare_lock);
+        while (!g.spare.empty() && free.size() < BLOCK_SIZE) {
+            free.push_back(g.spare.back());
+            g.spare.pop_back();
+        }
+    }
+
+    static void give_spare(std::vector<uint32_t> &free) {
+        if (free.empty()) {
+            return;
+        }
+        global_t &g = global();
+        std::lock_guard<std::mutex> lock(g.spare_lock);
+        g.spare.insert(g.spare.end(), free.begin(), free.end());
+        free.clear();
+    }
+};
+
+}
+
+#endif
@@ -0,0 +1,78 @@
+/// \file inbox.hpp
+///
+/// inbox_t is a lock free multi-producer single-consumer queue.
+/// any thread can post messages, and only the owner thread takes them,
+/// all at once, in the order they were posted.
+///
+/// messages are linked by their `next` member, so the queue allocates nothing.
+/// a batch of messages linked by the producer is posted by a single CAS.
+/// posting is seq_cst, so a consumer going to sleep can check empty() after
+/// announcing it, and a producer can check the announcement after posting.
+///
+/// \author ingangi
+/// \version 0.1.0
+/// \date 2026-10-17
+
+#ifndef INBOX_HPP
+#define INBOX_HPP
+
+#include <atomic>
+
+namespace chr {
+
+template<typename T>
+class inbox_t final
+{
+public:
+    inbox_t() {}
+
+    // post the messages linked by `next` from @first, in order, by any thread.
+    // the `next` of the last one must be nullptr.
+    void post(T *first) {
+        // it's a stack inside, push them reversed
+        T *top = nullptr;
+        for (T *msg = first; msg; ) {
+            T *next = msg->next;
+            msg->next = top;
+            top = msg;
+            msg = next;
+        }
+
+        T *head = m_head.load(std::memory_order_relaxed);
+        do {
+            first->next = head;
+        } while (!m_head.compare_exchange_weak(head, top
+            , std::memory_order_seq_cst, std::memory_order_relaxed));
+    }
+
+    // take all the messages in posted order, by the owner thread only
+    T *take() {
+        T *head = m_head.exchange(nullptr, std::memory_order_acquire);
+        // they were pushed as a stack, reverse it
+        T *first = nullptr;
+        while (head) {
+            T *next = head->next;
+            head->next = first;
+            first = head;
+            head = next;
+        }
+        return first;
+    }
+
+    bool empty() const {
+        return m_head.load(std::memory_order_seq_cst) == nullptr;
+    }
+
+private:
+    inbox_t(const inbox_t &) = delete;
+    inbox_t(inbox_t &&) = delete;
+    inbox_t& operator=(const inbox_t &) = delete;
+    inbox_t& operator=(inbox_t &&) = delete;
+
+private:
+    std::atomic<T *>    m_head{nullptr};
+};
+
+}
+
+#endif
@@ -0,0 +1,167 @@
+/// \file intrusive.hpp
+///
+/// intrusive_ptr_t is a smart pointer of objects counting their references by themselves,
+/// (`add_ref()` and `release()`), so no control block is allocated like std::shared_ptr.
+///
+/// intrusive_list_t links objects by the list_hook_t member inside them,
+/// so no list node is allocated. it doesn't own the objects.
+/// an object can be in only one list through the same hook at a time.
+///
+/// \author ingangi
+/// \version 0.1.0
+/// \date 2026-10-17
+
+#ifndef INTRUSIVE_HPP
+#define INTRUSIVE_HPP
+
+#include <stddef.h>
+
+namespace chr {
+
+template<typename T>
+class intrusive_ptr_t
+{
+public:
+    intrusive_ptr_t() {}
+    intrusive_ptr_t(T *p, bool add_ref = true) : m_p(p) {
+        if (m_p && add_ref) {
+            m_p->add_ref();
+        }
+    }
+    intrusive_ptr_t(const intrusive_ptr_t &other) : intrusive_ptr_t(other.m_p) {}
+    intrusive_ptr_t(intrusive_ptr_t &&other) : m_p(other.m_p) {
+        other.m_p = nullptr;
+    }
+    ~intrusive_ptr_t() {
+        reset();
+    }
+
+    intrusive_ptr_t& operator=(const intrusive_ptr_t &other) {
+        intrusive_ptr_t(other).swap(*this);
+        return *this;
+    }
+    intrusive_ptr_t& operator=(intrusive_ptr_t &&other) {
+        intrusive_ptr_t(static_cast<intrusive_ptr_t &&>(other)).swap(*this);
+        return *this;
+    }
+
+    void reset() {
+        if (m_p) {
+            m_p->release();
+            m_p = nullptr;
+        }
+    }
+
+    // give up the reference without releasing it
+    T *detach() {
+        T *p = m_p;
+        m_p = nullptr;
+        return p;
+    }
+
+    void swap(intrusive_ptr_t &other) {
+        T *p = m_p;
+        m_p = other.m_p;
+        other.m_p = p;
+    }
+
+    T *get() const {
+        return m_p;
+    }
+    T *operator->() const {
+        return m_p;
+    }
+    T &operator*() const {
+        return *m_p;
+    }
+    explicit operator bool() const {
+        return m_p != nullptr;
+    }
+
+private:
+    T * m_p = nullptr;
+};
+
+template<typename T>
+struct list_hook_t {
+    T *     prev = nullptr;
+    T *     next = nullptr;
+    bool    linked = false;
+};
+
+template<typename T, list_hook_t<T> T::*Hook>
+class intrusive_list_t
+{
+public:
+    bool empty() const {
+        return m_head == nullptr;
+    }
+    size_t size() const {
+        return m_size;
+    }
+    T *front() const {
+        return m_head;
+    }
+    T *back() const {
+        return m_tail;
+    }
+    static T *next(T *p) {
+        return (p->*Hook).next;
+    }
+    static T *prev(T *p) {
+        return (p->*Hook).prev;
+    }
+    static bool linked(T *p) {
+        return (p->*Hook).linked;
+    }
+
+    void push_back(T *p) {
+        list_hook_t<T> &hook = p->*Hook;
+        hook.prev = m_tail;
+        hook.next = nullptr;
+        hook.linked = true;
+        if (m_tail) {
+            (m_tail->*Hook).next = p;
+        } else {
+            m_head = p;
+        }
+        m_tail = p;
+        m_size++;
+    }
+
+    // @p must be in this list
+    void remove(T *p) {
+        list_hook_t<T> &hook = p->*Hook;
+        if (hook.prev) {
+            (hook.prev->*Hook).next = hook.next;
+        } else {
+            m_head = hook.next;
+        }
+        if (hook.next) {
+            (hook.next->*Hook).prev = hook.prev;
+        } else {
+            m_tail = hook.prev;
+        }
+        hook.prev = nullptr;
+        hook.next = nullptr;
+        hook.linked = false;
+        m_size--;
+    }
+
+    T *pop_front() {
+        T *p = m_head;
+        if (p) {
+            remove(p);
+        }
+        return p;
+    }
+
+private:
+    T *     m_head = nullptr;
+    T *     m_tail = nullptr;
+    size_t  m_size = 0;
+};
+
+}
+
+#endif
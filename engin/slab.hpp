@@ -0,0 +1,203 @@
+/// \file slab.hpp
+///
+/// slab_t carves objects of the same type from big chunks,
+/// each os thread has its own slab, so allocating is lock free.
+/// objects can be freed by any thread: if it's not the owner thread,
+/// they are pushed to a lock free list and taken back by the owner later.
+///
+/// slab_allocator_t adapts slab_t for STL containers,
+/// single nodes come from the slab, arrays from the heap.
+///
+/// \author ingangi
+/// \version 0.1.0
+/// \date 2026-10-17
+
+#ifndef SLAB_HPP
+#define SLAB_HPP
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <new>
+#include <atomic>
+#include <vector>
+#include <memory>
+
+namespace chr {
+
+template<typename T>
+class slab_t final
+{
+    typedef struct node_t {
+        node_t *    next;
+    } node_t;
+
+    // every object is preceded by a header telling which slab it belongs to
+    typedef struct header_t {
+        slab_t *    owner;
+    } header_t;
+
+    static const size_t ALIGN = alignof(std::max_align_t) > alignof(T) ? alignof(std::max_align_t) : alignof(T);
+    static const size_t HEADER_SIZE = (sizeof(header_t) + ALIGN - 1) / ALIGN * ALIGN;
+    static const size_t BODY_SIZE = sizeof(T) > sizeof(node_t) ? sizeof(T) : sizeof(node_t);
+    static const size_t SLOT_SIZE = (HEADER_SIZE + BODY_SIZE + ALIGN - 1) / ALIGN * ALIGN;
+    static const size_t CHUNK_SLOTS = 64;
+
+    // destroys the slab of the thread when the thread exits,
+    // the slab lives on until all of its objects were freed.
+    typedef struct holder_t {
+        slab_t *    slab = nullptr;
+        bool        exited = false;
+        ~holder_t() {
+            exited = true;
+            if (slab) {
+                slab->put_live();
+            }
+        }
+    } holder_t;
+
+public:
+    // memory for a T from the slab of current thread
+    static void *alloc() {
+        slab_t *slab = local();
+        if (slab == nullptr) {
+            // the thread is exiting, no slab any more
+            char *slot = static_cast<char *>(::operator new(SLOT_SIZE));
+            reinterpret_cast<header_t *>(slot)->owner = nullptr;
+            return slot + HEADER_SIZE;
+        }
+        return slab->alloc_local();
+    }
+
+    // give back the memory of a T, can be called by any thread
+    static void free(void *p) {
+        if (p == nullptr) {
+            return;
+        }
+
+        char *slot = static_cast<char *>(p) - HEADER_SIZE;
+        slab_t *owner = reinterpret_cast<header_t *>(slot)->owner;
+        if (owner == nullptr) {
+            ::operator delete(slot);
+            return;
+        }
+
+        node_t *node = reinterpret_cast<node_t *>(p);
+        if (owner == local()) {
+            node->next = owner->m_free;
+            owner->m_free = node;
+        } else {
+            node_t *head = owner->m_remote_free.load(std::memory_order_relaxed);
+            do {
+                node->next = head;
+            } while (!owner->m_remote_free.compare_exchange_weak(head, node
+                , std::memory_order_release, std::memory_order_relaxed));
+        }
+        owner->put_live();
+    }
+
+    ~slab_t() {
+        for (auto chunk : m_chunks) {
+            ::free(chunk);
+        }
+    }
+
+private:
+    slab_t() {}
+    slab_t(const slab_t &) = delete;
+    slab_t(slab_t &&) = delete;
+    slab_t& operator=(const slab_t &) = delete;
+    slab_t& operator=(slab_t &&) = delete;
+
+    static slab_t *local() {
+        static thread_local holder_t holder;
+        if (holder.exited) {
+            return nullptr;
+        }
+        if (holder.slab == nullptr) {
+            holder.slab = new slab_t();
+        }
+        return holder.slab;
+    }
+
+    void *alloc_local() {
+        if (m_free == nullptr) {
+            // take back the objects freed by other threads
+            m_free = m_remote_free.exchange(nullptr, std::memory_order_acquire);
+        }
+        if (m_free == nullptr) {
+            new_chunk();
+        }
+
+        node_t *node = m_free;
+        m_free = node->next;
+        m_live.fetch_add(1, std::memory_order_relaxed);
+        return node;
+    }
+
+    void new_chunk() {
+        char *chunk = static_cast<char *>(aligned_alloc(ALIGN, SLOT_SIZE * CHUNK_SLOTS));
+        if (chunk == nullptr) {
+            throw std::bad_alloc();
+        }
+        m_chunks.push_back(chunk);
+        for (size_t i = CHUNK_SLOTS; i > 0; i--) {
+            char *slot = chunk + (i - 1) * SLOT_SIZE;
+            reinterpret_cast<header_t *>(slot)->owner = this;
+            node_t *node = reinterpret_cast<node_t *>(slot + HEADER_SIZE);
+            node->next = m_free;
+            m_free = node;
+        }
+    }
+
+    // one for each live object, and one for the owner thread
+    void put_live() {
+        if (m_live.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            delete this;
+        }
+    }
+
+private:
+    std::vector<char *>     m_chunks;
+    node_t *                m_free = nullptr;
+    std::atomic<node_t *>   m_remote_free{nullptr};
+    std::atomic<size_t>     m_live{1};
+};
+
+template<typename T>
+class slab_allocator_t
+{
+public:
+    typedef T value_type;
+
+    slab_allocator_t() {}
+    template<typename U>
+    slab_allocator_t(const slab_allocator_t<U> &) {}
+
+    T *allocate(size_t n) {
+        if (n == 1) {
+            return static_cast<T *>(slab_t<T>::alloc());
+        }
+        return std::allocator<T>().allocate(n);
+    }
+
+    void deallocate(T *p, size_t n) {
+        if (n == 1) {
+            slab_t<T>::free(p);
+            return;
+        }
+        std::allocator<T>().deallocate(p, n);
+    }
+
+    template<typename U>
+    bool operator==(const slab_allocator_t<U> &) const {
+        return true;
+    }
+    template<typename U>
+    bool operator!=(const slab_allocator_t<U> &) const {
+        return false;
+    }
+};
+
+}
+
+#endif
@@ -0,0 +1,240 @@
+#include <unistd.h>
+#include <stdint.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/mman.h>
+#include "stack_pool.hpp"
+#include "logger.hpp"
+
+namespace chr {
+
+namespace {
+
+// set when the pool of the thread is destroyed,
+// stacks released after that are unmapped directly.
+thread_local bool t_pool_destroyed = false;
+
+const uint64_t PAINT_PATTERN = 0xA5A5A5A5A5A5A5A5ULL;
+
+}
+
+std::atomic<bool> stack_pool_t::ms_painting(false);
+std::mutex stack_pool_t::ms_usage_lock;
+stack_usage_map_t stack_pool_t::ms_usage;
+
+stack_pool_t::~stack_pool_t()
+{
+    for (auto &it : m_free_stacks) {
+        for (auto base : it.second.bases) {
+            stack_mem_t stack;
+            stack.base = base;
+            stack.size = it.first;
+            unmap(stack);
+        }
+    }
+    m_free_stacks.clear();
+    t_pool_destroyed = true;
+}
+
+stack_pool_t *stack_pool_t::local()
+{
+    static thread_local stack_pool_t pool;
+    if (t_pool_destroyed) {
+        return nullptr;
+    }
+    return &pool;
+}
+
+size_t stack_pool_t::page_size()
+{
+    static size_t size = sysconf(_SC_PAGESIZE);
+    return size;
+}
+
+size_t stack_pool_t::round_size(size_t size)
+{
+    for (int i = 0; i < stack_class_count; i++) {
+        if (size <= STACK_CLASS_SIZES[i]) {
+            return STACK_CLASS_SIZES[i];
+        }
+    }
+
+    size_t page = page_size();
+    return (size + page - 1) / page * page;
+}
+
+stack_mem_t stack_pool_t::acquire(size_t size)
+{
+    size = round_size(size);
+
+    stack_pool_t *pool = local();
+    if (pool == nullptr) {
+        return map(size);
+    }
+    return pool->alloc(size);
+}
+
+size_t stack_pool_t::trim()
+{
+    stack_pool_t *pool = local();
+    if (pool == nullptr) {
+        return 0;
+    }
+    return pool->trim_all();
+}
+
+void stack_pool_t::release(stack_mem_t & stack)
+{
+    if (stack.empty()) {
+        return;
+    }
+
+    stack_pool_t *pool = local();
+    if (pool == nullptr) {
+        unmap(stack);
+        return;
+    }
+    pool->free(stack);
+}
+
+stack_mem_t stack_pool_t::map(size_t size)
+{
+    stack_mem_t stack;
+    size_t guard = page_size();
+    void *p = mmap(nullptr, size + guard, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (p == MAP_FAILED) {
+        SPDLOG(ERROR, "stack_pool_t mmap {} bytes failed: {}", size + guard, strerror(errno));
+        return stack;
+    }
+
+    // stack grows down, the lowest page is the guard
+    if (mprotect(p, guard, PROT_NONE) != 0) {
+        SPDLOG(ERROR, "stack_pool_t mprotect guard page failed: {}", strerror(errno));
+        munmap(p, size + guard);
+        return stack;
+    }
+
+    stack.base = static_cast<char *>(p) + guard;
+    stack.size = size;
+    return stack;
+}
+
+void stack_pool_t::unmap(stack_mem_t & stack)
+{
+    size_t guard = page_size();
+    if (munmap(stack.base - guard, stack.size + guard) != 0) {
+        SPDLOG(ERROR, "stack_pool_t munmap {:p} failed: {}", (void*)(stack.base), strerror(errno));
+    }
+    stack = stack_mem_t();
+}
+
+stack_mem_t stack_pool_t::alloc(size_t size)
+{
+    auto iter = m_free_stacks.find(size);
+    if (iter == m_free_stacks.end() || iter->second.bases.empty()) {
+        return map(size);
+    }
+
+    stack_list_t &stacks = iter->second;
+    stack_mem_t stack;
+    stack.base = stacks.bases.back();
+    stack.size = size;
+    stacks.bases.pop_back();
+    if (stacks.advised > stacks.bases.size()) {
+        stacks.advised = stacks.bases.size();
+    }
+    return stack;
+}
+
+void stack_pool_t::free(stack_mem_t & stack)
+{
+    stack_list_t &stacks = m_free_stacks[stack.size];
+    if (stacks.bases.size() >= MAX_CACHED_STACKS) {
+        unmap(stack);
+        return;
+    }
+
+    stacks.bases.push_back(stack.base);
+    stack = stack_mem_t();
+    m_untrimmed++;
+}
+
+size_t stack_pool_t::trim_all()
+{
+    if (m_untrimmed == 0) {
+        return 0;
+    }
+    m_untrimmed = 0;
+
+    size_t trimmed = 0;
+    for (auto &it : m_free_stacks) {
+        stack_list_t &stacks = it.second;
+        if (stacks.bases.size() <= HOT_CACHED_STACKS) {
+            continue;
+        }
+
+        size_t cold = stacks.bases.size() - HOT_CACHED_STACKS;
+        for (; stacks.advised < cold; stacks.advised++) {
+            if (madvise(stacks.bases[stacks.advised], it.first, MADV_DONTNEED) != 0) {
+                SPDLOG(ERROR, "stack_pool_t madvise failed: {}", strerror(errno));
+                break;
+            }
+            trimmed++;
+        }
+    }
+    return trimmed;
+}
+
+void stack_pool_t::set_painting(bool on)
+{
+    ms_painting.store(on, std::memory_order_relaxed);
+}
+
+bool stack_pool_t::painting()
+{
+    return ms_painting.load(std::memory_order_relaxed);
+}
+
+void stack_pool_t::paint(stack_mem_t & stack)
+{
+    uint64_t *p = reinterpret_cast<uint64_t *>(stack.base);
+    uint64_t *end = reinterpret_cast<uint64_t *>(stack.top());
+    for (; p < end; p++) {
+        *p = PAINT_PATTERN;
+    }
+}
+
+size_t stack_pool_t::high_water_mark(const stack_mem_t & stack)
+{
+    // stack grows down, the first dirty word from the bottom is the deepest one
+    const uint64_t *p = reinterpret_cast<const uint64_t *>(stack.base);
+    const uint64_t *end = reinterpret_cast<const uint64_t *>(stack.top());
+    while (p < end && *p == PAINT_PATTERN) {
+        p++;
+    }
+    return stack.top() - reinterpret_cast<const char *>(p);
+}
+
+void stack_pool_t::record_usage(const char *tag, const stack_mem_t & stack)
+{
+    size_t used = high_water_mark(stack);
+
+    std::lock_guard<std::mutex> lck(ms_usage_lock);
+    stack_usage_t &usage = ms_usage[tag ? tag : ""];
+    usage.count++;
+    usage.total_used += used;
+    if (used > usage.max_used) {
+        usage.max_used = used;
+    }
+    if (stack.size > usage.stack_size) {
+        usage.stack_size = stack.size;
+    }
+}
+
+stack_usage_map_t stack_pool_t::usage()
+{
+    std::lock_guard<std::mutex> lck(ms_usage_lock);
+    return ms_usage;
+}
+
+}
@@ -0,0 +1,147 @@
+/// \file stack_pool.hpp
+///
+/// stack_pool_t caches the stacks of finished chroutines for reusing,
+/// each os thread has its own pool, so no lock is needed.
+/// stacks are mmap-ed with a PROT_NONE guard page below,
+/// stack overflow faults instead of corrupting the memory of others.
+///
+/// small stacks are rounded up to size classes so they can be reused by
+/// chroutines asking for similar sizes, and stacks idle in the pool are
+/// given back to the kernel (MADV_DONTNEED) when the thread has nothing to do.
+///
+/// with painting on, stacks are filled with a pattern when created and
+/// scanned for the high-water mark when the chroutine exits, the result is
+/// aggregated by the tag of the chroutine.
+///
+/// \author ingangi
+/// \version 0.1.0
+/// \date 2026-10-17
+
+#ifndef STACK_POOL_HPP
+#define STACK_POOL_HPP
+
+#include <stddef.h>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <unordered_map>
+
+namespace chr {
+
+// max count of cached stacks of each size in a pool
+const size_t MAX_CACHED_STACKS = 256;
+
+// count of recently released stacks of each size kept resident when trimming the pool
+const size_t HOT_CACHED_STACKS = 8;
+
+typedef enum {
+    stack_class_8k = 0,
+    stack_class_32k,
+    stack_class_128k,
+    stack_class_512k,
+    stack_class_count,
+} stack_class_t;
+
+const size_t STACK_CLASS_SIZES[stack_class_count] = {
+    1024*8,
+    1024*32,
+    1024*128,
+    1024*512,
+};
+
+// usable memory of a stack, the guard page is below `base`
+typedef struct stack_mem_t {
+    char *  base = nullptr;
+    size_t  size = 0;
+
+    bool empty() const {
+        return base == nullptr;
+    }
+    char *top() const {
+        return base + size;
+    }
+} stack_mem_t;
+
+// stack usage of the finished chroutines with the same tag
+typedef struct stack_usage_t {
+    size_t  count = 0;          // finished chroutines
+    size_t  max_used = 0;       // high-water mark in bytes
+    size_t  total_used = 0;     // total_used/count is the average
+    size_t  stack_size = 0;     // the biggest stack size they got
+} stack_usage_t;
+
+typedef std::map<std::string, stack_usage_t> stack_usage_map_t;
+
+class stack_pool_t final
+{
+public:
+    ~stack_pool_t();
+
+    // get a stack of at least @size bytes from the pool of current thread.
+    // returns an empty stack if out of memory.
+    static stack_mem_t acquire(size_t size);
+
+    // give back the stack to the pool of current thread
+    static void release(stack_mem_t & stack);
+
+    // give the memory of idle stacks in the pool of current thread back to the kernel,
+    // except the HOT_CACHED_STACKS most recently released ones of each size.
+    // returns count of stacks trimmed.
+    static size_t trim();
+
+    // the size a stack of @size really gets: the smallest class fits, or page aligned
+    static size_t round_size(size_t size);
+
+    // page size of the system
+    static size_t page_size();
+
+    // stack painting, off by default.
+    // painting touches every page of the stack, turn it on for measurement only.
+    static void set_painting(bool on);
+    static bool painting();
+    static void paint(stack_mem_t & stack);
+
+    // scan a painted stack, returns the bytes were used
+    static size_t high_water_mark(const stack_mem_t & stack);
+
+    // add the usage of a painted stack to the stat of @tag
+    static void record_usage(const char *tag, const stack_mem_t & stack);
+
+    // get a copy of the stat
+    static stack_usage_map_t usage();
+
+private:
+    stack_pool_t() {}
+    stack_pool_t(const stack_pool_t &) = delete;
+    stack_pool_t(stack_pool_t &&) = delete;
+    stack_pool_t& operator=(const stack_pool_t &) = delete;
+    stack_pool_t& operator=(stack_pool_t &&) = delete;
+
+    // the pool of current thread, nullptr if the thread is exiting
+    static stack_pool_t *local();
+
+    static stack_mem_t map(size_t size);
+    static void unmap(stack_mem_t & stack);
+
+    stack_mem_t alloc(size_t size);
+    void free(stack_mem_t & stack);
+    size_t trim_all();
+
+private:
+    typedef struct {
+        std::vector<char *> bases;      // released stacks, the last one is the hottest
+        size_t              advised = 0;// bases[0, advised) were given back to the kernel
+    } stack_list_t;
+    std::unordered_map<size_t, stack_list_t>    m_free_stacks;  // size -> stacks
+    size_t                                      m_untrimmed = 0;
+
+    static std::atomic<bool>                    ms_painting;
+    static std::mutex                           ms_usage_lock;
+    static stack_usage_map_t                    ms_usage;
+};
+
+}
+
+#endif
@@ -0,0 +1,314 @@
+#include "sync.hpp"
+
+namespace chr {
+
+namespace {
+
+const int RWLOCK_READER = 0;
+const int RWLOCK_WRITER = 1;
+
+}
+
+wait_list_t::waiter_t *wait_list_t::wake_one(unpark_list_t & unparks)
+{
+    waiter_t *waiter = m_waiters.pop_front();
+    if (waiter == nullptr) {
+        return nullptr;
+    }
+    waiter->woken = true;
+    if (waiter->chroutine == INVALID_ID) {
+        m_cond.notify_all();
+    } else {
+        unparks.push_back(waiter->chroutine);
+    }
+    return waiter;
+}
+
+void wait_list_t::wake_all(unpark_list_t & unparks)
+{
+    bool threads = false;
+    while (waiter_t *waiter = m_waiters.pop_front()) {
+        waiter->woken = true;
+        if (waiter->chroutine == INVALID_ID) {
+            threads = true;
+        } else {
+            unparks.push_back(waiter->chroutine);
+        }
+    }
+    if (threads) {
+        m_cond.notify_all();
+    }
+}
+
+void wait_list_t::wait_thread(std::unique_lock<std::mutex> & lock, waiter_t & me, std::time_t deadline)
+{
+    while (!me.woken) {
+        if (deadline == 0) {
+            m_cond.wait(lock);
+            continue;
+        }
+        std::time_t left = deadline - mono_clock_t::now_ms();
+        if (left <= 0) {
+            break;
+        }
+        m_cond.wait_for(lock, std::chrono::milliseconds(left));
+    }
+}
+
+bool condvar_t::wait(chutex_t & chtex, std::time_t timeout_ms)
+{
+    std::time_t deadline = wait_list_t::deadline_of(timeout_ms);
+    bool woken = false;
+    try {
+        std::unique_lock<std::mutex> lock(m_lock);
+        // queued before unlocking, so a notify right after the unlock is not lost
+        chtex.unlock();
+        woken = m_waiters.wait(lock, 0, deadline, [this](bool woken, wait_list_t::unpark_list_t & unparks) {
+            if (woken) {
+                // it's not going to act on the notify, pass it on
+                m_waiters.wake_one(unparks);
+            }
+        });
+    } catch (const chroutine_cancelled_t &) {
+        cancel_shield_t shield;
+        chtex.lock();
+        throw;
+    }
+
+    // the caller holds it again whatever happens
+    cancel_shield_t shield;
+    chtex.lock();
+    return woken;
+}
+
+void condvar_t::notify_one()
+{
+    wait_list_t::unpark_list_t unparks;
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        m_waiters.wake_one(unparks);
+    }
+    wait_list_t::unpark(unparks);
+}
+
+void condvar_t::notify_all()
+{
+    wait_list_t::unpark_list_t unparks;
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        m_waiters.wake_all(unparks);
+    }
+    wait_list_t::unpark(unparks);
+}
+
+bool semaphore_t::acquire(std::time_t timeout_ms)
+{
+    std::unique_lock<std::mutex> lock(m_lock);
+    if (m_count > 0) {
+        m_count--;
+        return true;
+    }
+
+    // woken means release() handed one to us
+    return m_waiters.wait(lock, 0, wait_list_t::deadline_of(timeout_ms),
+        [this](bool woken, wait_list_t::unpark_list_t & unparks) {
+            if (woken) {
+                release_locked(1, unparks);
+            }
+        });
+}
+
+bool semaphore_t::try_acquire()
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    if (m_count > 0) {
+        m_count--;
+        return true;
+    }
+    return false;
+}
+
+void semaphore_t::release(int64_t n)
+{
+    wait_list_t::unpark_list_t unparks;
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        release_locked(n, unparks);
+    }
+    wait_list_t::unpark(unparks);
+}
+
+int64_t semaphore_t::count()
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    return m_count;
+}
+
+void semaphore_t::release_locked(int64_t n, wait_list_t::unpark_list_t & unparks)
+{
+    while (n > 0 && m_waiters.wake_one(unparks)) {
+        n--;
+    }
+    m_count += n;
+}
+
+bool rwlock_t::lock(std::time_t timeout_ms)
+{
+    return lock(false, timeout_ms);
+}
+
+bool rwlock_t::try_lock()
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    if (m_writer || m_readers > 0 || !m_waiters.empty()) {
+        return false;
+    }
+    m_writer = true;
+    return true;
+}
+
+void rwlock_t::unlock()
+{
+    wait_list_t::unpark_list_t unparks;
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        m_writer = false;
+        grant(unparks);
+    }
+    wait_list_t::unpark(unparks);
+}
+
+bool rwlock_t::lock_shared(std::time_t timeout_ms)
+{
+    return lock(true, timeout_ms);
+}
+
+bool rwlock_t::try_lock_shared()
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    if (m_writer || !m_waiters.empty()) {
+        return false;
+    }
+    m_readers++;
+    return true;
+}
+
+void rwlock_t::unlock_shared()
+{
+    wait_list_t::unpark_list_t unparks;
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        m_readers--;
+        grant(unparks);
+    }
+    wait_list_t::unpark(unparks);
+}
+
+bool rwlock_t::lock(bool shared, std::time_t timeout_ms)
+{
+    std::unique_lock<std::mutex> lock(m_lock);
+    if (m_waiters.empty() && !m_writer && (shared || m_readers == 0)) {
+        if (shared) {
+            m_readers++;
+        } else {
+            m_writer = true;
+        }
+        return true;
+    }
+
+    // woken means grant() let us in already
+    int kind = shared ? RWLOCK_READER : RWLOCK_WRITER;
+    bool woken = m_waiters.wait(lock, kind, wait_list_t::deadline_of(timeout_ms),
+        [this, shared](bool woken, wait_list_t::unpark_list_t & unparks) {
+            if (woken && shared) {
+                m_readers--;
+            } else if (woken) {
+                m_writer = false;
+            }
+            grant(unparks);
+        });
+    if (!woken) {
+        // a writer giving up may let the readers behind it in
+        wait_list_t::unpark_list_t unparks;
+        grant(unparks);
+        lock.unlock();
+        wait_list_t::unpark(unparks);
+    }
+    return woken;
+}
+
+void rwlock_t::grant(wait_list_t::unpark_list_t & unparks)
+{
+    while (!m_writer && !m_waiters.empty()) {
+        if (m_waiters.front()->kind == RWLOCK_WRITER) {
+            if (m_readers > 0) {
+                break;
+            }
+            m_writer = true;
+        } else {
+            m_readers++;
+        }
+        m_waiters.wake_one(unparks);
+    }
+}
+
+void wait_group_t::add(int64_t n)
+{
+    wait_list_t::unpark_list_t unparks;
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        m_count += n;
+        if (m_count < 0) {
+            SPDLOG(ERROR, "{} error: wait_group({:p}) counter goes negative: {}", __FUNCTION__, (void*)this, m_count);
+            m_count = 0;
+        }
+        if (m_count == 0) {
+            m_waiters.wake_all(unparks);
+        }
+    }
+    wait_list_t::unpark(unparks);
+}
+
+void wait_group_t::done()
+{
+    add(-1);
+}
+
+bool wait_group_t::wait(std::time_t timeout_ms)
+{
+    std::unique_lock<std::mutex> lock(m_lock);
+    if (m_count == 0) {
+        return true;
+    }
+    return m_waiters.wait(lock, 0, wait_list_t::deadline_of(timeout_ms),
+        [](bool, wait_list_t::unpark_list_t &) {});
+}
+
+int64_t wait_group_t::count()
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    return m_count;
+}
+
+bool barrier_t::arrive_and_wait()
+{
+    std::unique_lock<std::mutex> lock(m_lock);
+    if (++m_arrived == m_parties) {
+        // the last one opens it, and the next phase begins
+        m_arrived = 0;
+        wait_list_t::unpark_list_t unparks;
+        m_waiters.wake_all(unparks);
+        lock.unlock();
+        wait_list_t::unpark(unparks);
+        return true;
+    }
+
+    m_waiters.wait(lock, 0, 0, [this](bool woken, wait_list_t::unpark_list_t &) {
+        if (!woken) {
+            m_arrived--;
+        }
+    });
+    return false;
+}
+
+}
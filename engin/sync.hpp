@@ -0,0 +1,309 @@
+/// \file sync.hpp
+///
+/// synchronization for chroutines, besides chutex_t and channel_t:
+/// condvar_t, semaphore_t, rwlock_t, wait_group_t and barrier_t.
+///
+/// a chroutine waiting on any of them is parked in a FIFO queue and unparked by
+/// whoever wakes it, from any worker or plain thread.
+/// a plain thread (or a worker out of any chroutine) waits on a condition variable.
+/// semaphore_t and rwlock_t hand what's released to the first waiters directly,
+/// so a woken waiter never has to fight newcomers for it.
+///
+/// a waiter cancelled (see cancel.hpp) leaves the queue before chroutine_cancelled_t goes out,
+/// and passes on anything that was handed to it meanwhile.
+///
+/// the queue node of a waiter is taken from the slab, not from its stack:
+/// wakers write it while the waiter is switched out, and the stack of a
+/// shared-stack chroutine holds the frames of another one by then.
+///
+/// \author ingangi
+/// \version 0.1.0
+/// \date 2026-10-17
+
+#ifndef SYNC_HPP
+#define SYNC_HPP
+
+#include <mutex>
+#include <memory>
+#include <vector>
+#include <condition_variable>
+#include "engine.hpp"
+#include "intrusive.hpp"
+#include "slab.hpp"
+
+namespace chr {
+
+// the waiters of one primitive, guarded by the primitive's lock
+class wait_list_t final
+{
+public:
+    typedef std::vector<chroutine_id_t> unpark_list_t;
+
+    typedef struct waiter_t {
+        chroutine_id_t          chroutine = INVALID_ID; // INVALID_ID: a plain thread
+        int                     kind = 0;               // what it waits for, up to the primitive
+        bool                    woken = false;
+        list_hook_t<waiter_t>   hook;
+
+        static void *operator new(size_t size) {
+            return slab_t<waiter_t>::alloc();
+        }
+        static void operator delete(void *p) {
+            slab_t<waiter_t>::free(p);
+        }
+    } waiter_t;
+
+    bool empty() const {
+        return m_waiters.empty();
+    }
+    size_t size() const {
+        return m_waiters.size();
+    }
+    waiter_t *front() const {
+        return m_waiters.front();
+    }
+
+    // wait in the queue till woken, or @deadline passes (ms of mono_clock_t, 0: never).
+    // @kind tells what it waits for, see waiter_t::kind.
+    // @lock is held when called and on return, return whether it was woken.
+    // if the chroutine is cancelled, @on_cancel(woken, unparks) is called under @lock,
+    // then @lock is released, the ones put in unparks are unparked, and it throws.
+    template<typename F>
+    bool wait(std::unique_lock<std::mutex> & lock, int kind, std::time_t deadline, F && on_cancel) {
+        std::unique_ptr<waiter_t> me(new waiter_t());
+        me->chroutine = ENGIN.get_current_chroutine_id();
+        me->kind = kind;
+        m_waiters.push_back(me.get());
+
+        if (me->chroutine == INVALID_ID) {
+            wait_thread(lock, *me, deadline);
+        } else {
+            while (!me->woken) {
+                std::time_t left = 0;
+                if (deadline != 0) {
+                    left = deadline - mono_clock_t::cached_ms();
+                    if (left <= 0) {
+                        break;
+                    }
+                }
+                lock.unlock();
+                try {
+                    ENGIN.park(left);
+                } catch (const chroutine_cancelled_t &) {
+                    lock.lock();
+                    if (!me->woken) {
+                        m_waiters.remove(me.get());
+                    }
+                    unpark_list_t unparks;
+                    on_cancel(me->woken, unparks);
+                    lock.unlock();
+                    unpark(unparks);
+                    throw;
+                }
+                lock.lock();
+            }
+        }
+
+        if (!me->woken) {
+            m_waiters.remove(me.get());
+        }
+        return me->woken;
+    }
+
+    // take the first waiter out and wake it, nullptr if none.
+    // a chroutine is put in @unparks, unpark it after releasing the lock.
+    waiter_t *wake_one(unpark_list_t & unparks);
+
+    // take all waiters out and wake them
+    void wake_all(unpark_list_t & unparks);
+
+    static void unpark(const unpark_list_t & unparks) {
+        for (auto id : unparks) {
+            ENGIN.unpark(id);
+        }
+    }
+
+    static std::time_t deadline_of(std::time_t timeout_ms) {
+        return timeout_ms > 0 ? mono_clock_t::round_ms() + timeout_ms : 0;
+    }
+
+private:
+    void wait_thread(std::unique_lock<std::mutex> & lock, waiter_t & me, std::time_t deadline);
+
+private:
+    intrusive_list_t<waiter_t, &waiter_t::hook> m_waiters;
+    std::condition_variable                     m_cond;     // for plain threads
+};
+
+// condition variable working with chutex_t.
+// as usual, check the condition in a loop: a waiter may return with it false.
+class condvar_t final
+{
+public:
+    condvar_t() {}
+
+    // unlock @chtex and wait for a notify, or @timeout_ms passes (0: never),
+    // then lock @chtex again. return false if timed out.
+    // @chtex is locked again even if the chroutine is cancelled.
+    bool wait(chutex_t & chtex, std::time_t timeout_ms = 0);
+
+    // wait till @pred() is true, return false if timed out with it still false
+    template<typename P>
+    bool wait_pred(chutex_t & chtex, P && pred, std::time_t timeout_ms = 0) {
+        std::time_t deadline = wait_list_t::deadline_of(timeout_ms);
+        while (!pred()) {
+            std::time_t left = 0;
+            if (deadline != 0) {
+                left = deadline - mono_clock_t::round_ms();
+                if (left <= 0) {
+                    return false;
+                }
+            }
+            wait(chtex, left);
+        }
+        return true;
+    }
+
+    void notify_one();
+    void notify_all();
+
+private:
+    condvar_t(const condvar_t&) = delete;
+    condvar_t& operator=(const condvar_t&) = delete;
+
+private:
+    std::mutex  m_lock;
+    wait_list_t m_waiters;
+};
+
+// counting semaphore
+class semaphore_t final
+{
+public:
+    explicit semaphore_t(int64_t count = 0) : m_count(count) {}
+
+    // take one, wait @timeout_ms at most (0: never time out), return false if timed out
+    bool acquire(std::time_t timeout_ms = 0);
+
+    bool try_acquire();
+
+    // give back @n, to the waiters first
+    void release(int64_t n = 1);
+
+    int64_t count();
+
+private:
+    semaphore_t(const semaphore_t&) = delete;
+    semaphore_t& operator=(const semaphore_t&) = delete;
+
+    void release_locked(int64_t n, wait_list_t::unpark_list_t & unparks);
+
+private:
+    std::mutex  m_lock;
+    int64_t     m_count;
+    wait_list_t m_waiters;
+};
+
+// readers-writer lock, FIFO: a reader coming after a waiting writer waits too,
+// so writers are not starved. the readers in a row at the queue head get in together.
+class rwlock_t final
+{
+public:
+    rwlock_t() {}
+
+    // return false if timed out (@timeout_ms 0: never)
+    bool lock(std::time_t timeout_ms = 0);
+    bool try_lock();
+    void unlock();
+
+    bool lock_shared(std::time_t timeout_ms = 0);
+    bool try_lock_shared();
+    void unlock_shared();
+
+private:
+    rwlock_t(const rwlock_t&) = delete;
+    rwlock_t& operator=(const rwlock_t&) = delete;
+
+    bool lock(bool shared, std::time_t timeout_ms);
+
+    // let in the waiters at the head if they can
+    void grant(wait_list_t::unpark_list_t & unparks);
+
+private:
+    std::mutex  m_lock;
+    int64_t     m_readers = 0;
+    bool        m_writer = false;
+    wait_list_t m_waiters;
+};
+
+class rwlock_guard_t final
+{
+public:
+    rwlock_guard_t(rwlock_t &rwlock, bool shared = false) : m_rwlock(rwlock), m_shared(shared) {
+        if (m_shared) {
+            m_rwlock.lock_shared();
+        } else {
+            m_rwlock.lock();
+        }
+    }
+    ~rwlock_guard_t() {
+        if (m_shared) {
+            m_rwlock.unlock_shared();
+        } else {
+            m_rwlock.unlock();
+        }
+    }
+private:
+    rwlock_t &  m_rwlock;
+    bool        m_shared;
+};
+
+// wait for a group of jobs: add() before starting each, done() when each finishes,
+// wait() returns when all are done.
+class wait_group_t final
+{
+public:
+    wait_group_t() {}
+
+    void add(int64_t n = 1);
+    void done();
+
+    // return false if timed out (@timeout_ms 0: never)
+    bool wait(std::time_t timeout_ms = 0);
+
+    int64_t count();
+
+private:
+    wait_group_t(const wait_group_t&) = delete;
+    wait_group_t& operator=(const wait_group_t&) = delete;
+
+private:
+    std::mutex  m_lock;
+    int64_t     m_count = 0;
+    wait_list_t m_waiters;
+};
+
+// @parties meet at the barrier, again and again.
+class barrier_t final
+{
+public:
+    explicit barrier_t(size_t parties) : m_parties(parties > 0 ? parties : 1) {}
+
+    // wait till all parties arrive. return true for the last one, which can do the
+    // work of the phase alone. a cancelled one takes back its arrival.
+    bool arrive_and_wait();
+
+private:
+    barrier_t(const barrier_t&) = delete;
+    barrier_t& operator=(const barrier_t&) = delete;
+
+private:
+    std::mutex      m_lock;
+    const size_t    m_parties;
+    size_t          m_arrived = 0;
+    wait_list_t     m_waiters;
+};
+
+}
+
+#endif
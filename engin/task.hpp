@@ -0,0 +1,177 @@
+/// \file task.hpp
+///
+/// task_t holds the callable a chroutine runs, like std::function<void(void *)>,
+/// but callables up to TASK_INLINE_SIZE bytes are stored in place,
+/// so creating a chroutine with a small lambda doesn't allocate.
+/// bigger callables are moved to the heap.
+///
+/// the callable can take the `void *arg` of the chroutine, or nothing.
+///
+/// \author ingangi
+/// \version 0.1.0
+/// \date 2026-10-17
+
+#ifndef TASK_HPP
+#define TASK_HPP
+
+#include <stddef.h>
+#include <new>
+#include <utility>
+#include <functional>
+#include <type_traits>
+
+namespace chr {
+
+// max size of a callable stored in place
+const size_t TASK_INLINE_SIZE = 64;
+
+class task_t final
+{
+    typedef struct ops_t {
+        void (*call)(void *f, void *arg);
+        void (*move)(void *from, void *to);    // move @from to @to and destroy @from
+        void (*destroy)(void *f);
+    } ops_t;
+
+    template<typename D>
+    struct fits_inline {
+        static const bool value = sizeof(D) <= TASK_INLINE_SIZE
+            && alignof(D) <= alignof(std::max_align_t)
+            && std::is_nothrow_move_constructible<D>::value;
+    };
+
+public:
+    task_t() {}
+    task_t(std::nullptr_t) {}
+
+    template<typename F
+        , typename D = typename std::decay<F>::type
+        , typename = typename std::enable_if<!std::is_same<D, task_t>::value>::type>
+    task_t(F &&f) {
+        if (is_null(f)) {
+            return;
+        }
+        init<D>(std::forward<F>(f), std::integral_constant<bool, fits_inline<D>::value>());
+    }
+
+    task_t(task_t &&other) {
+        other.move_to(*this);
+    }
+
+    task_t& operator=(task_t &&other) {
+        if (this != &other) {
+            reset();
+            other.move_to(*this);
+        }
+        return *this;
+    }
+
+    ~task_t() {
+        reset();
+    }
+
+    void operator()(void *arg) {
+        m_ops->call(m_buf, arg);
+    }
+
+    explicit operator bool() const {
+        return m_ops != nullptr;
+    }
+    bool operator==(std::nullptr_t) const {
+        return m_ops == nullptr;
+    }
+    bool operator!=(std::nullptr_t) const {
+        return m_ops != nullptr;
+    }
+
+    void reset() {
+        if (m_ops) {
+            m_ops->destroy(m_buf);
+            m_ops = nullptr;
+        }
+    }
+
+private:
+    task_t(const task_t &) = delete;
+    task_t& operator=(const task_t &) = delete;
+
+    void move_to(task_t &to) {
+        if (m_ops) {
+            m_ops->move(m_buf, to.m_buf);
+            to.m_ops = m_ops;
+            m_ops = nullptr;
+        }
+    }
+
+    template<typename D, typename F>
+    void init(F &&f, std::true_type) {
+        ::new (static_cast<void *>(m_buf)) D(std::forward<F>(f));
+        static const ops_t ops = {&call_inline<D>, &move_inline<D>, &destroy_inline<D>};
+        m_ops = &ops;
+    }
+
+    template<typename D, typename F>
+    void init(F &&f, std::false_type) {
+        *reinterpret_cast<D **>(m_buf) = new D(std::forward<F>(f));
+        static const ops_t ops = {&call_heap<D>, &move_heap, &destroy_heap<D>};
+        m_ops = &ops;
+    }
+
+    template<typename D>
+    static void call_inline(void *f, void *arg) {
+        invoke(*static_cast<D *>(f), arg, 0);
+    }
+    template<typename D>
+    static void move_inline(void *from, void *to) {
+        ::new (to) D(std::move(*static_cast<D *>(from)));
+        static_cast<D *>(from)->~D();
+    }
+    template<typename D>
+    static void destroy_inline(void *f) {
+        static_cast<D *>(f)->~D();
+    }
+
+    template<typename D>
+    static void call_heap(void *f, void *arg) {
+        invoke(**static_cast<D **>(f), arg, 0);
+    }
+    static void move_heap(void *from, void *to) {
+        *static_cast<void **>(to) = *static_cast<void **>(from);
+    }
+    template<typename D>
+    static void destroy_heap(void *f) {
+        delete *static_cast<D **>(f);
+    }
+
+    // f(arg) if it takes the arg, or f()
+    template<typename D>
+    static auto invoke(D &f, void *arg, int) -> decltype(f(arg), void()) {
+        f(arg);
+    }
+    template<typename D>
+    static void invoke(D &f, void *, long) {
+        f();
+    }
+
+    // empty std::function and null function pointers make an empty task
+    template<typename D>
+    static bool is_null(const D &) {
+        return false;
+    }
+    template<typename R, typename... A>
+    static bool is_null(const std::function<R(A...)> &f) {
+        return !f;
+    }
+    template<typename R, typename... A>
+    static bool is_null(R (* const &f)(A...)) {
+        return f == nullptr;
+    }
+
+private:
+    alignas(std::max_align_t) unsigned char m_buf[TASK_INLINE_SIZE];
+    const ops_t *   m_ops = nullptr;
+};
+
+}
+
+#endif
@@ -0,0 +1,102 @@
+/// \file thread_registry.hpp
+///
+/// thread_registry_t publishes the worker threads for lock free reading.
+/// they are kept in a fixed array of slots with a count, so readers (placing,
+/// stealing, looking up by thread id) just index it without any lock.
+/// writers (adding and retiring workers) must be serialized by the caller.
+///
+/// removing swaps the last one into the hole, so a reader walking the slots
+/// at that moment may miss one or see one twice, which is fine for picking a
+/// thread. it may also get a thread just removed, so the removed threads must
+/// be kept alive for a while (see engine_t::retire_worker).
+///
+/// \author ingangi
+/// \version 0.1.0
+/// \date 2026-10-17
+
+#ifndef THREAD_REGISTRY_HPP
+#define THREAD_REGISTRY_HPP
+
+#include <stddef.h>
+#include <atomic>
+
+namespace chr {
+
+template<typename T, size_t N>
+class thread_registry_t final
+{
+public:
+    thread_registry_t() {
+        for (size_t i = 0; i < N; i++) {
+            m_slots[i].store(nullptr, std::memory_order_relaxed);
+        }
+    }
+
+    size_t size() const {
+        return m_size.load(std::memory_order_acquire);
+    }
+
+    bool empty() const {
+        return size() == 0;
+    }
+
+    // the one at @index, nullptr if it was just removed
+    T *at(size_t index) const {
+        if (index >= N) {
+            return nullptr;
+        }
+        return m_slots[index].load(std::memory_order_acquire);
+    }
+
+    // walk all of them, @func(T *) returns true to stop
+    template<typename F>
+    T *find_if(F func) const {
+        size_t count = size();
+        for (size_t i = 0; i < count; i++) {
+            T *p = at(i);
+            if (p && func(p)) {
+                return p;
+            }
+        }
+        return nullptr;
+    }
+
+    // by the writer only, false if it's full
+    bool add(T *p) {
+        size_t count = m_size.load(std::memory_order_relaxed);
+        if (count >= N) {
+            return false;
+        }
+        m_slots[count].store(p, std::memory_order_release);
+        m_size.store(count + 1, std::memory_order_release);
+        return true;
+    }
+
+    // by the writer only, false if it's not here
+    bool remove(T *p) {
+        size_t count = m_size.load(std::memory_order_relaxed);
+        for (size_t i = 0; i < count; i++) {
+            if (m_slots[i].load(std::memory_order_relaxed) != p) {
+                continue;
+            }
+            T *last = m_slots[count - 1].load(std::memory_order_relaxed);
+            m_slots[i].store(last, std::memory_order_release);
+            m_size.store(count - 1, std::memory_order_release);
+            m_slots[count - 1].store(nullptr, std::memory_order_release);
+            return true;
+        }
+        return false;
+    }
+
+private:
+    thread_registry_t(const thread_registry_t &) = delete;
+    thread_registry_t& operator=(const thread_registry_t &) = delete;
+
+private:
+    std::atomic<T *>    m_slots[N];
+    std::atomic<size_t> m_size{0};
+};
+
+}
+
+#endif
@@ -0,0 +1,212 @@
+/// \file timing_wheel.hpp
+///
+/// timing_wheel_t keeps timers in a hierarchical timing wheel (like the old linux kernel timers),
+/// in millisecond ticks. adding and canceling a timer are O(1),
+/// and advancing only touches the timers which are due, or cascaded to a lower level.
+/// the empty slots of level 0 are skipped by a bitmap, so a wheel ticking fast (in us)
+/// doesn't step through every tick passed.
+///
+/// level 0 has 256 slots of 1ms, level 1-3 have 64 slots of 256ms, 16s and 17min.
+/// timers further than 18 hours are put in the last slot of level 3,
+/// and moved again when cascaded.
+///
+/// the timers are timer_node_t embedded in the owner objects, so no memory is allocated.
+///
+/// \author ingangi
+/// \version 0.1.0
+/// \date 2026-10-17
+
+#ifndef TIMING_WHEEL_HPP
+#define TIMING_WHEEL_HPP
+
+#include <stdint.h>
+#include <ctime>
+#include "intrusive.hpp"
+
+namespace chr {
+
+template<typename T>
+struct timer_node_t {
+    list_hook_t<timer_node_t>   hook;
+    std::time_t                 expire = 0;
+    uint32_t                    slot = 0;
+    T *                         owner = nullptr;
+
+    bool pending() const {
+        return hook.linked;
+    }
+};
+
+template<typename T>
+class timing_wheel_t final
+{
+    typedef timer_node_t<T> node_t;
+    typedef intrusive_list_t<node_t, &node_t::hook> slot_t;
+
+    static const int ROOT_BITS = 8;
+    static const int LEVEL_BITS = 6;
+    static const int LEVELS = 4;
+    static const uint32_t ROOT_SIZE = 1 << ROOT_BITS;
+    static const uint32_t LEVEL_SIZE = 1 << LEVEL_BITS;
+    static const uint32_t SLOT_COUNT = ROOT_SIZE + LEVEL_SIZE * (LEVELS - 1);
+    static const std::time_t MAX_DELTA = (std::time_t(1) << (ROOT_BITS + LEVEL_BITS * (LEVELS - 1))) - 1;
+
+public:
+    // @now: current time in ms
+    explicit timing_wheel_t(std::time_t now) : m_tick(now) {}
+
+    // (re)start @node to expire at @expire (ms)
+    void add(node_t *node, std::time_t expire) {
+        if (node->pending()) {
+            cancel(node);
+        }
+        node->expire = expire;
+        place(node);
+        m_count++;
+    }
+
+    void cancel(node_t *node) {
+        if (!node->pending()) {
+            return;
+        }
+        m_slots[node->slot].remove(node);
+        m_count--;
+        if (node->slot < ROOT_SIZE && m_slots[node->slot].empty()) {
+            mark(node->slot, false);
+        }
+    }
+
+    // expire all the timers due before or at @now, @on_expire(T *) is called for each
+    template<typename F>
+    void advance(std::time_t now, F && on_expire) {
+        if (m_count == 0) {
+            if (now >= m_tick) {
+                m_tick = now + 1;
+            }
+            return;
+        }
+
+        while (m_tick <= now && m_count > 0) {
+            uint32_t index = m_tick & (ROOT_SIZE - 1);
+            if (index == 0) {
+                cascade(1);
+            }
+
+            slot_t &slot = m_slots[index];
+            while (!slot.empty()) {
+                node_t *node = slot.pop_front();
+                m_count--;
+                on_expire(node->owner);
+            }
+            mark(index, false);
+
+            // the slots till the next busy one are empty, or till the wrap which cascades
+            std::time_t next = m_tick + (busy_root_from(index + 1) - index);
+            m_tick = next <= now ? next : now + 1;
+        }
+        if (m_tick <= now) {
+            m_tick = now + 1;
+        }
+    }
+
+    // the earliest tick before @limit that advance() should run at, or @limit.
+    // it may be earlier than the real deadline when a higher level is going to be cascaded.
+    std::time_t next_expire(std::time_t limit) const {
+        if (m_count == 0) {
+            return limit;
+        }
+        // the next busy slot of level 0, or the wrap
+        uint32_t index = m_tick & (ROOT_SIZE - 1);
+        std::time_t tick = m_tick + (busy_root_from(index) - index);
+        return limit < tick ? limit : tick;
+    }
+
+    size_t size() const {
+        return m_count;
+    }
+
+private:
+    timing_wheel_t(const timing_wheel_t &) = delete;
+    timing_wheel_t(timing_wheel_t &&) = delete;
+    timing_wheel_t& operator=(const timing_wheel_t &) = delete;
+    timing_wheel_t& operator=(timing_wheel_t &&) = delete;
+
+    void place(node_t *node) {
+        std::time_t expire = node->expire;
+        std::time_t delta = expire - m_tick;
+        uint32_t slot = 0;
+        if (delta < 0) {
+            // due already, run at the next tick
+            slot = m_tick & (ROOT_SIZE - 1);
+        } else if (delta < ROOT_SIZE) {
+            slot = expire & (ROOT_SIZE - 1);
+        } else {
+            if (delta > MAX_DELTA) {
+                // re-placed when cascaded
+                expire = m_tick + MAX_DELTA;
+            }
+            int level = 1;
+            int shift = ROOT_BITS;
+            while (level < LEVELS - 1 && delta >= (std::time_t(1) << (shift + LEVEL_BITS))) {
+                level++;
+                shift += LEVEL_BITS;
+            }
+            slot = ROOT_SIZE + LEVEL_SIZE * (level - 1) + ((expire >> shift) & (LEVEL_SIZE - 1));
+        }
+        node->slot = slot;
+        m_slots[slot].push_back(node);
+        if (slot < ROOT_SIZE) {
+            mark(slot, true);
+        }
+    }
+
+    void mark(uint32_t index, bool busy) {
+        if (busy) {
+            m_root_busy[index / 64] |= uint64_t(1) << (index % 64);
+        } else {
+            m_root_busy[index / 64] &= ~(uint64_t(1) << (index % 64));
+        }
+    }
+
+    // the first busy slot of level 0 from @index on, ROOT_SIZE if none
+    uint32_t busy_root_from(uint32_t index) const {
+        for (uint32_t word = index / 64; word < ROOT_SIZE / 64; word++) {
+            uint64_t bits = m_root_busy[word];
+            if (word == index / 64) {
+                bits &= ~uint64_t(0) << (index % 64);
+            }
+            if (bits != 0) {
+                return word * 64 + __builtin_ctzll(bits);
+            }
+        }
+        return ROOT_SIZE;
+    }
+
+    // move the timers of the current slot in @level down, called when the lower level wraps
+    void cascade(int level) {
+        int shift = ROOT_BITS + LEVEL_BITS * (level - 1);
+        uint32_t index = (m_tick >> shift) & (LEVEL_SIZE - 1);
+        if (index == 0 && level < LEVELS - 1) {
+            cascade(level + 1);
+        }
+
+        slot_t &slot = m_slots[ROOT_SIZE + LEVEL_SIZE * (level - 1) + index];
+        slot_t moving;
+        while (!slot.empty()) {
+            moving.push_back(slot.pop_front());
+        }
+        while (!moving.empty()) {
+            place(moving.pop_front());
+        }
+    }
+
+private:
+    slot_t          m_slots[SLOT_COUNT];
+    uint64_t        m_root_busy[ROOT_SIZE / 64] = {0};  // the slots of level 0 not empty
+    std::time_t     m_tick;         // the next tick to process
+    size_t          m_count = 0;
+};
+
+}
+
+#endif
@@ -7,3 +7,17 @@ target_include_directories(chroutine INTERFACE
     ${CMAKE_CURRENT_SOURCE_DIR}/../../net/http_client
     ${CMAKE_CURRENT_SOURCE_DIR}/../../net/rpc
     ${CMAKE_CURRENT_SOURCE_DIR}/../../net/proto_code)
+
+# context switch backend: hand-written assembly by default (x86-64/aarch64),
+# turn this on to fall back to ucontext.
+option(CHR_USE_UCONTEXT "switch chroutines with ucontext instead of assembly" OFF)
+if(CHR_USE_UCONTEXT)
+    target_compile_definitions(chroutine INTERFACE CHR_USE_UCONTEXT)
+endif()
+
+# read the TSC for the scheduler clock on x86-64 (see mono_clock.hpp),
+# it falls back to clock_gettime at runtime if the TSC is not invariant.
+option(CHR_USE_TSC "use the TSC as the scheduler clock" OFF)
+if(CHR_USE_TSC)
+    target_compile_definitions(chroutine INTERFACE CHR_USE_TSC)
+endif()
@@ -0,0 +1,127 @@
+#include <stdio.h>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include "engine.hpp"
+
+using namespace chr;
+
+// contention of chutex_t against the spin lock it replaced, which YIELDs
+// between its tries (and spins the os thread out of a chroutine).
+// chroutines on all workers (or plain threads) take the lock in turn
+// and hold it for a short critical section, or across a YIELD.
+
+static const long LOCKS = 200000;
+static const int WORKERS = 4;
+static const int CASES[] = {4, 64, 512};
+static const int THREAD_CASES[] = {2, 8};
+
+// the spin lock chutex_t was
+class spin_chutex_t final
+{
+public:
+    void lock() {
+        bool expected = false;
+        while (!m_flag.compare_exchange_weak(expected, true, std::memory_order_acquire)) {
+            expected = false;
+            YIELD();
+        }
+    }
+    void unlock() {
+        m_flag.store(false, std::memory_order_release);
+    }
+
+private:
+    std::atomic<bool> m_flag{false};
+};
+
+static double now_ns()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+template<typename L>
+static void critical_section(L &lock, long &counter, bool yield_inside)
+{
+    lock.lock();
+    counter++;
+    if (yield_inside) {
+        YIELD();
+    }
+    lock.unlock();
+}
+
+template<typename L>
+static void bench_chroutines(const char *name, int chroutines, bool yield_inside)
+{
+    static L lock;
+    static long counter;
+    static std::atomic<int> alive;
+    counter = 0;
+    alive = chroutines;
+    long each = LOCKS / chroutines;
+
+    double begin = now_ns();
+    for (int i = 0; i < chroutines; i++) {
+        ENGIN.create_chroutine([each, yield_inside](void *){
+            for (long n = 0; n < each; n++) {
+                critical_section(lock, counter, yield_inside);
+            }
+            alive--;
+        }, nullptr);
+    }
+    while (alive > 0) {
+        SLEEP(1);
+    }
+    double cost = now_ns() - begin;
+    printf("%-8s %-12d %-8s %-10ld %.1f\n", name, chroutines, yield_inside ? "yes" : "no"
+        , counter, cost / counter);
+}
+
+template<typename L>
+static void bench_threads(const char *name, int threads)
+{
+    static L lock;
+    static long counter;
+    counter = 0;
+    long each = LOCKS / threads;
+
+    double begin = now_ns();
+    std::vector<std::thread> pool;
+    for (int i = 0; i < threads; i++) {
+        pool.push_back(std::thread([each](){
+            for (long n = 0; n < each; n++) {
+                critical_section(lock, counter, false);
+            }
+        }));
+    }
+    for (auto &t : pool) {
+        t.join();
+    }
+    double cost = now_ns() - begin;
+    printf("%-8s %-12d %-8s %-10ld %.1f\n", name, threads, "thread", counter, cost / counter);
+}
+
+int main(int argc, char **argv)
+{
+    ENGINE_INIT(WORKERS);
+
+    ENGIN.create_chroutine([](void *){
+        printf("lock     chroutines   yield    locks      ns/lock\n");
+        for (bool yield_inside : {false, true}) {
+            for (int chroutines : CASES) {
+                bench_chroutines<spin_chutex_t>("spin", chroutines, yield_inside);
+                bench_chroutines<chutex_t>("chutex", chroutines, yield_inside);
+            }
+        }
+        for (int threads : THREAD_CASES) {
+            bench_threads<spin_chutex_t>("spin", threads);
+            bench_threads<chutex_t>("chutex", threads);
+        }
+        ENGIN.stop_all();
+    }, nullptr);
+
+    ENGIN.run();
+    return 0;
+}
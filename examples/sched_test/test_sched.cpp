@@ -1,7 +1,24 @@
+#include <string.h>
+#include <unistd.h>
+#include <sys/syscall.h>
 #include "engine.hpp"
+#include "channel.hpp"
+#include "future.hpp"
+#include "sync.hpp"
 
 using namespace chr;
 
+// a failed check is logged, and makes the exit code non-zero (see main)
+static std::atomic<int> g_failed_checks(0);
+
+#define CHECK(cond) do { \
+    if (!(cond)) { \
+        g_failed_checks++; \
+        SPDLOG(ERROR, "check failed at line {}: {}", __LINE__, #cond); \
+        fprintf(stderr, "check failed at line %d: %s\n", __LINE__, #cond); \
+    } \
+} while (0)
+
 void test_resettle_sched() {
     ENGIN.create_chroutine([](void *){
         int i = 0;
@@ -35,6 +52,51 @@ void test_resettle_sched() {
 
 }
 
+void test_blocked_sched() {
+    // a chroutine blocking its worker is reported by the watchdog,
+    // and the one sleeping beside it wakes up on another worker
+    watchdog_config_t config;
+    config.check_ms = 10;
+    config.blocked_ms = 100;
+    ENGIN.set_watchdog(config);
+
+    static std::atomic<int> done(0);
+    static std::atomic<long> sleeper_before(0);
+    static std::atomic<long> sleeper_after(0);
+    chroutine_attr_t attr;
+    attr.placement = placement_t::local;
+    ENGIN.create_chroutine([](void *){
+        sleeper_before = syscall(SYS_gettid);
+        SLEEP(300);
+        sleeper_after = syscall(SYS_gettid);
+        done++;
+    }, nullptr, attr);
+    chroutine_id_t blocker = ENGIN.create_chroutine([](void *){
+        usleep(500000);
+        done++;
+    }, nullptr, attr);
+
+    // till the watchdog finds the worker recovered too, nothing is placed on it before
+    bool reported = false;
+    std::time_t blocked_ms = 0;
+    for (int i = 0; i < 500 && (done < 2 || blocked_ms == 0); i++) {
+        SLEEP(10);
+        for (auto &event : ENGIN.blocked_events()) {
+            if (event.chroutine == blocker) {
+                reported = event.moved >= 1;
+                blocked_ms = event.blocked_ms;
+            }
+        }
+    }
+    SPDLOG(INFO, "blocked by chroutine({}) for {} ms", blocker, blocked_ms);
+    CHECK(done == 2);
+    CHECK(reported);
+    CHECK(blocked_ms >= 400);
+    CHECK(sleeper_after != sleeper_before);
+
+    ENGIN.set_watchdog(watchdog_config_t());
+}
+
 void test_fair_sched() {
     ENGIN.create_chroutine([](void *){
         int i = 0;
@@ -73,12 +135,556 @@ void test_fair_sched() {
     }, nullptr);
 }
 
+// lots of sleeping chroutines shouldn't slow down the running ones, nor wake up early
+void test_many_sleeping_sched() {
+    static const int SLEEPING_COUNT = 50000;
+    static std::atomic<int> woken(0);
+    static std::atomic<int> unwound(0);
+    static wait_group_t ended;
+    ended.add(SLEEPING_COUNT);
+    chroutine_attr_t attr;
+    attr.shared_stack = true;
+    attr.placement = placement_t::local;
+    attr.token = cancel_token_t::create();
+    for (int i = 0; i < SLEEPING_COUNT; i++) {
+        ENGIN.create_chroutine([](void *){
+            try {
+                SLEEP(3600*1000);
+            } catch (const chroutine_cancelled_t &) {
+                unwound++;
+                ended.done();
+                throw;
+            }
+            woken++;
+            ended.done();
+        }, nullptr, attr);
+    }
+
+    SLEEP(1000);    // all of them are sleeping now
+    static const int YIELD_COUNT = 100000;
+    std::time_t begin = get_time_stamp();
+    for (int i = 0; i < YIELD_COUNT; i++) {
+        YIELD();
+    }
+    std::time_t cost = get_time_stamp() - begin;
+    SPDLOG(INFO, "{} yields with {} sleeping chroutines cost {} ms", YIELD_COUNT, SLEEPING_COUNT, cost);
+    CHECK(woken == 0);
+
+    // unwind them, their SLEEP throws. wait till all of them are done however long it takes,
+    // the next scenario would share the worker with the rest otherwise
+    begin = get_time_stamp();
+    attr.token.cancel();
+    CHECK(ended.wait(60 * 1000));
+    SPDLOG(INFO, "{} sleeping chroutines unwound in {} ms", unwound.load(), get_time_stamp() - begin);
+    // the last ones are leaving their entries, let them go
+    SLEEP(10);
+    CHECK(unwound == SLEEPING_COUNT);
+    CHECK(woken == 0);
+}
+
+void test_steal_sched() {
+    // a burst of busy chroutines on this thread, the idle ones steal the unpinned ones
+    static const int BURST_COUNT = 40;
+    static std::atomic<int> done(0);
+    static std::atomic<int> stolen(0);
+    static std::atomic<int> pinned_moved(0);
+    static std::atomic<long> home(0);
+    home = syscall(SYS_gettid);     // not std::this_thread::get_id(), it may be cached across switches
+
+    // the others are idle before the burst, or they may not be there to steal:
+    // this one isn't parked as it's running me
+    for (int i = 0; i < 500 && ENGIN.idle_worker_count() + 1 < ENGIN.worker_count(); i++) {
+        SLEEP(10);
+    }
+    CHECK(ENGIN.idle_worker_count() + 1 == ENGIN.worker_count());
+
+    std::time_t begin = get_time_stamp();
+    for (int i = 0; i < BURST_COUNT; i++) {
+        chroutine_attr_t attr;
+        attr.pinned = (i % 4 == 0);
+        bool pinned = attr.pinned;
+        ENGIN.create_son_chroutine([pinned](void *){
+            // seen anywhere but home, it may be stolen back before it ends
+            bool away = false;
+            for (int k = 0; k < 5; k++) {
+                std::time_t busy = get_time_stamp();
+                while (get_time_stamp() - busy < 10) {}
+                YIELD();
+                away = away || syscall(SYS_gettid) != home;
+            }
+            if (away) {
+                pinned ? pinned_moved++ : stolen++;
+            }
+            done++;
+        }, nullptr, attr);
+    }
+    for (int i = 0; i < 1000 && done < BURST_COUNT; i++) {
+        SLEEP(5);
+    }
+    SPDLOG(INFO, "{} busy chroutines cost {} ms, {} stolen", BURST_COUNT, get_time_stamp() - begin, stolen.load());
+    CHECK(done == BURST_COUNT);
+    CHECK(stolen > 0);
+    CHECK(pinned_moved == 0);
+}
+
+void test_priority_sched() {
+    // the same busy loop in each class on one worker: the higher class gets more rounds,
+    // and the lower ones still get some
+    static long rounds[PRIORITY_CLASSES] = {0};
+    static std::atomic<bool> stop(false);
+    static std::atomic<int> stopped(0);
+    priority_t classes[PRIORITY_CLASSES] = {priority_t::critical, priority_t::normal, priority_t::batch};
+    for (int c = 0; c < PRIORITY_CLASSES; c++) {
+        chroutine_attr_t attr;
+        attr.priority = classes[c];
+        attr.placement = placement_t::local;
+        attr.pinned = true;
+        ENGIN.create_chroutine([c](void *){
+            while (!stop) {
+                rounds[c]++;
+                YIELD();
+            }
+            stopped++;
+        }, nullptr, attr);
+    }
+
+    SLEEP(1000);
+    stop = true;
+    for (int i = 0; i < 500 && stopped < PRIORITY_CLASSES; i++) {
+        SLEEP(10);
+    }
+    SPDLOG(INFO, "rounds: critical {}, normal {}, batch {}", rounds[0], rounds[1], rounds[2]);
+    CHECK(stopped == PRIORITY_CLASSES);
+    CHECK(rounds[0] > rounds[1]);
+    CHECK(rounds[0] > rounds[2]);
+    CHECK(rounds[1] > 0);
+    CHECK(rounds[2] > 0);
+}
+
+void test_preempt_sched() {
+    // two chroutines never yielding share one worker with this one, which still wakes up
+    // from its sleeps: the preemptible one is switched out by the signal,
+    // the other one at its PREEMPT_POINT
+    static std::atomic<bool> stop(false);
+    static std::atomic<int> stopped(0);
+    static std::atomic<long> spinner_home(0);
+    static std::atomic<int> spinner_moved(0);
+    chroutine_attr_t attr;
+    attr.placement = placement_t::local;
+    attr.preemptible = true;
+    // no locks in a preemptible one, just atomics
+    chroutine_id_t spinner = ENGIN.create_chroutine([](void *){
+        spinner_home = syscall(SYS_gettid);
+        volatile long n = 0;
+        while (!stop) {
+            if (++n % (1 << 20) == 0 && syscall(SYS_gettid) != spinner_home) {
+                spinner_moved++;
+            }
+        }
+        stopped++;
+    }, nullptr, attr);
+
+    attr.preemptible = false;
+    chroutine_id_t looper = ENGIN.create_chroutine([](void *){
+        long n = 0;
+        while (!stop) {
+            if (++n % 1024 == 0) {
+                PREEMPT_POINT();
+            }
+        }
+        stopped++;
+    }, nullptr, attr);
+
+    std::time_t max_slept = 0;
+    for (int i = 0; i < 5; i++) {
+        std::time_t begin = get_time_stamp();
+        SLEEP(100);
+        std::time_t slept = get_time_stamp() - begin;
+        max_slept = std::max(max_slept, slept);
+        SPDLOG(INFO, "slept {} ms, overruns: spinner {}, looper {}"
+            , slept, ENGIN.get_overruns(spinner), ENGIN.get_overruns(looper));
+    }
+    int spinner_overruns = ENGIN.get_overruns(spinner);
+    int looper_overruns = ENGIN.get_overruns(looper);
+    stop = true;
+    for (int i = 0; i < 500 && stopped < 2; i++) {
+        SLEEP(10);
+    }
+    CHECK(stopped == 2);
+    CHECK(max_slept < 1000);
+    CHECK(spinner_overruns > 0);
+    CHECK(looper_overruns > 0);
+    CHECK(spinner_moved == 0);
+}
+
+// the pool config test_elastic_sched runs with, see main
+pool_config_t elastic_config() {
+    pool_config_t config;
+    config.min_workers = 1;
+    config.max_workers = 4;
+    config.shrink_checks = 5;
+    return config;
+}
+
+void test_elastic_sched() {
+    // sustained load grows the pool up to max_workers, and it shrinks back to min_workers
+    // when the workers are idle again
+    static const int BURST_COUNT = 64;
+    static std::atomic<bool> stop(false);
+    static std::atomic<int> done(0);
+    pool_config_t config = elastic_config();
+    CHECK(ENGIN.worker_count() == config.min_workers);
+    for (int i = 0; i < BURST_COUNT; i++) {
+        ENGIN.create_chroutine([](void *){
+            while (!stop) {
+                std::time_t busy = get_time_stamp();
+                while (get_time_stamp() - busy < 2) {}
+                YIELD();
+            }
+            done++;
+        }, nullptr);
+    }
+
+    // the load lasts till the pool is full, it never goes beyond
+    size_t peak = 0;
+    std::time_t begin = get_time_stamp();
+    for (int i = 0; i < 300 && peak < config.max_workers; i++) {
+        SLEEP(100);
+        peak = std::max(peak, ENGIN.worker_count());
+    }
+    SPDLOG(INFO, "grew to {} workers in {} ms", peak, get_time_stamp() - begin);
+    stop = true;
+    for (int i = 0; i < 500 && done < BURST_COUNT; i++) {
+        SLEEP(10);
+        peak = std::max(peak, ENGIN.worker_count());
+    }
+    CHECK(done == BURST_COUNT);
+    CHECK(peak == config.max_workers);
+
+    // idle now, they retire one by one
+    begin = get_time_stamp();
+    for (int i = 0; i < 600 && ENGIN.worker_count() > config.min_workers; i++) {
+        SLEEP(50);
+    }
+    SPDLOG(INFO, "shrank to {} workers in {} ms", ENGIN.worker_count(), get_time_stamp() - begin);
+    CHECK(ENGIN.worker_count() == config.min_workers);
+
+    // and the one left still runs new chroutines
+    static std::atomic<int> more(0);
+    for (int i = 0; i < 100; i++) {
+        ENGIN.create_chroutine([](void *){
+            SLEEP(5);
+            more++;
+        }, nullptr);
+    }
+    for (int i = 0; i < 500 && more < 100; i++) {
+        SLEEP(10);
+    }
+    CHECK(more == 100);
+}
+
+void test_park_sched() {
+    // a parked waiter is unparked by a plain thread, an unpark ahead of the park isn't lost,
+    // a park times out, and a stale unpark doesn't end a HOLD
+    static std::atomic<chroutine_id_t> waiter(INVALID_ID);
+    static std::atomic<bool> holding(false);
+    static std::atomic<int> done(0);
+    static bool by_thread = false, ahead = false, timed_out = true;
+    static std::time_t by_thread_ms = 0, ahead_ms = 0, held_ms = 0;
+    ENGIN.create_chroutine([](void *){
+        waiter = ENGIN.get_current_chroutine_id();
+        std::time_t begin = get_time_stamp();
+        by_thread = ENGIN.park(2000);
+        by_thread_ms = get_time_stamp() - begin;
+
+        ENGIN.unpark(waiter);
+        begin = get_time_stamp();
+        ahead = ENGIN.park(2000);
+        ahead_ms = get_time_stamp() - begin;
+
+        timed_out = !ENGIN.park(30);
+
+        // the permit left here must not end the HOLD, only awake_chroutine does
+        ENGIN.unpark(waiter);
+        holding = true;
+        begin = get_time_stamp();
+        HOLD();
+        held_ms = get_time_stamp() - begin;
+        done++;
+    }, nullptr);
+
+    std::thread([](){
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        ENGIN.unpark(waiter);
+    }).detach();
+
+    for (int i = 0; i < 500 && !holding; i++) {
+        SLEEP(10);
+    }
+    SLEEP(100);
+    ENGIN.awake_chroutine(waiter);
+    for (int i = 0; i < 500 && done < 1; i++) {
+        SLEEP(10);
+    }
+    SPDLOG(INFO, "unparked by a thread in {} ms, ahead in {} ms, held {} ms", by_thread_ms, ahead_ms, held_ms);
+    CHECK(done == 1);
+    CHECK(by_thread);
+    CHECK(by_thread_ms < 1000);
+    CHECK(ahead);
+    CHECK(ahead_ms < 100);
+    CHECK(timed_out);
+    CHECK(held_ms >= 80);
+
+    // readers and writers parked in a channel, all on the shared stack of this worker:
+    // the peers pass the data while they're switched out and the stack holds other frames
+    static const int CHAN_PEERS = 4;
+    static const int CHAN_ITEMS = 100;
+    static std::shared_ptr<channel_t<int> > chan = channel_t<int>::create(1);
+    static std::atomic<int> chan_done(0);
+    static std::atomic<long> chan_sum(0);
+    chroutine_attr_t attr;
+    attr.shared_stack = true;
+    attr.placement = placement_t::local;
+    for (int i = 0; i < CHAN_PEERS; i++) {
+        ENGIN.create_chroutine([](void *){
+            for (int k = 0; k < CHAN_ITEMS; k++) {
+                int value = 0;
+                *chan >> value;
+                chan_sum += value;
+            }
+            chan_done++;
+        }, nullptr, attr);
+        ENGIN.create_chroutine([](void *){
+            for (int k = 1; k <= CHAN_ITEMS; k++) {
+                *chan << k;
+            }
+            chan_done++;
+        }, nullptr, attr);
+    }
+    for (int i = 0; i < 500 && chan_done < 2 * CHAN_PEERS; i++) {
+        SLEEP(10);
+    }
+    CHECK(chan_done == 2 * CHAN_PEERS);
+    CHECK(chan_sum == CHAN_PEERS * CHAN_ITEMS * (CHAN_ITEMS + 1) / 2);
+}
+
+void test_future_sched() {
+    // fan out to chroutines and a plain thread, join with when_all and when_any
+    std::vector<future_t<int> > parts;
+    for (int i = 0; i < 8; i++) {
+        parts.push_back(async_chroutine([i]() {
+            SLEEP(10 * i);
+            return i;
+        }));
+    }
+
+    std::shared_ptr<promise_t<int> > from_thread(new promise_t<int>());
+    parts.push_back(from_thread->get_future());
+    std::thread([from_thread](){
+        std::this_thread::sleep_for(std::chrono::milliseconds(30));
+        from_thread->set_value(100);
+    }).detach();
+
+    std::time_t begin = get_time_stamp();
+    size_t first = parts.size();
+    CHECK(when_any(parts).get(first, 2000));
+    CHECK(first < parts.size());
+    CHECK(when_all(parts).wait(2000));
+    int sum = 0;
+    for (auto &f : parts) {
+        sum += f.get();
+    }
+    SPDLOG(INFO, "first {}, sum {} in {} ms", first, sum, get_time_stamp() - begin);
+    CHECK(sum == 28 + 100);
+
+    // a wait times out, and dropping the promise breaks the future
+    std::unique_ptr<promise_t<int> > never(new promise_t<int>());
+    future_t<int> never_set = never->get_future();
+    int value = 0;
+    CHECK(!never_set.wait(30));
+    CHECK(!never_set.ready());
+    never.reset();
+    CHECK(never_set.ready());
+    CHECK(never_set.broken());
+    CHECK(!never_set.get(value, 30));
+}
+
+void test_cancel_sched() {
+    // the son of a timed out WAIT and a tree under a token are unwound, not dropped
+    typedef struct {
+        int unused;
+    } son_data_t;
+    static std::atomic<int> released(0);
+    static std::atomic<int> roots_unwound(0);
+    static std::atomic<int> sons_unwound(0);
+    reporter_base_t *rpt = ENGIN.create_son_chroutine([](void *){
+        std::shared_ptr<int> held(new int(0), [](int *p) {
+            released++;
+            delete p;
+        });
+        SLEEP(1000);
+    }, reporter_t<son_data_t>::create(), 100);
+    son_result_t result = rpt ? rpt->get_result() : result_done;
+    for (int i = 0; i < 100 && released < 1; i++) {
+        SLEEP(10);
+    }
+    SPDLOG(INFO, "son result {}, released {}", result, released.load());
+    CHECK(rpt != nullptr);
+    CHECK(result == result_timeout);
+    CHECK(released == 1);
+
+    chroutine_attr_t attr;
+    attr.token = cancel_token_t::create();
+    ENGIN.create_chroutine([](void *){
+        ENGIN.create_son_chroutine([](void *){
+            try {
+                while (1) {
+                    SLEEP(1000);
+                }
+            } catch (const chroutine_cancelled_t &) {
+                sons_unwound++;
+                throw;
+            }
+        }, nullptr);
+        try {
+            while (1) {
+                YIELD();
+            }
+        } catch (const chroutine_cancelled_t &e) {
+            SPDLOG(INFO, "tree root: {}", e.what());
+            roots_unwound++;
+            throw;
+        }
+    }, nullptr, attr);
+    SLEEP(200);
+    attr.token.cancel();
+    for (int i = 0; i < 100 && (roots_unwound < 1 || sons_unwound < 1); i++) {
+        SLEEP(10);
+    }
+    CHECK(roots_unwound == 1);
+    CHECK(sons_unwound == 1);
+}
+
+void test_sync_sched() {
+    // a queue fed by a plain thread through condvar_t, drained by chroutines on all workers,
+    // a semaphore_t limiting them and a wait_group_t joining them
+    const int JOBS = 8;
+    static chutex_t lock;
+    static condvar_t not_empty;
+    static std::deque<int> jobs;
+    std::thread([JOBS](){
+        for (int i = 0; i < JOBS; i++) {
+            {
+                chutex_guard_t guard(lock);
+                jobs.push_back(i);
+            }
+            not_empty.notify_one();
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }).detach();
+
+    static semaphore_t slots(2);
+    static wait_group_t wg;
+    static std::atomic<int> received(0);
+    static std::atomic<int> job_sum(0);
+    static std::atomic<int> inside(0);
+    static std::atomic<int> max_inside(0);
+    std::time_t begin = get_time_stamp();
+    for (int i = 0; i < JOBS; i++) {
+        wg.add();
+        ENGIN.create_chroutine([](void *){
+            int job = 0;
+            {
+                chutex_guard_t guard(lock);
+                not_empty.wait_pred(lock, [](){ return !jobs.empty(); });
+                job = jobs.front();
+                jobs.pop_front();
+            }
+            received++;
+            job_sum += job;
+            slots.acquire();
+            int now_inside = ++inside;
+            int max = max_inside;
+            while (now_inside > max && !max_inside.compare_exchange_weak(max, now_inside)) {
+            }
+            SLEEP(10);
+            inside--;
+            slots.release();
+            wg.done();
+        }, nullptr);
+    }
+    CHECK(wg.wait(5000));
+    SPDLOG(INFO, "{} jobs done in {} ms, {} at a time at most", received.load(), get_time_stamp() - begin, max_inside.load());
+    CHECK(received == JOBS);
+    CHECK(job_sum == JOBS * (JOBS - 1) / 2);
+    CHECK(max_inside <= 2);
+    CHECK(slots.count() == 2);
+
+    // readers share a rwlock_t, a writer waits for them; a barrier_t opens for the last one
+    static rwlock_t rwlock;
+    CHECK(rwlock.lock_shared(100));
+    CHECK(rwlock.try_lock_shared());
+    CHECK(!rwlock.lock(30));
+    rwlock.unlock_shared();
+    rwlock.unlock_shared();
+    CHECK(rwlock.try_lock());
+    rwlock.unlock();
+
+    static barrier_t barrier(3);
+    static std::atomic<int> serials(0);
+    static std::atomic<int> passed(0);
+    wait_group_t parties;
+    for (int i = 0; i < 3; i++) {
+        parties.add();
+        ENGIN.create_chroutine([&parties](void *){
+            if (barrier.arrive_and_wait()) {
+                serials++;
+            }
+            passed++;
+            parties.done();
+        }, nullptr);
+    }
+    CHECK(parties.wait(5000));
+    CHECK(passed == 3);
+    CHECK(serials == 1);
+}
+
 int main(int argc, char **argv)
 {
-    ENGINE_INIT(2);
+    // "schedtest elastic" checks the elastic pool, it needs an engine of its own
+    bool elastic = argc > 1 && strcmp(argv[1], "elastic") == 0;
+    if (elastic) {
+        ENGIN.init(elastic_config());
+    } else {
+        ENGINE_INIT(2);
+    }
 
+    // these only log what they do, call one of them instead of the checked ones to watch it
     //test_fair_sched();
-    test_resettle_sched();
+    //test_resettle_sched();
+
+    // the checked ones run one by one, then the engine stops
+    if (elastic) {
+        ENGIN.create_chroutine([](void *){
+            test_elastic_sched();
+            ENGIN.stop_all();
+        }, nullptr);
+    } else {
+        ENGIN.create_chroutine([](void *){
+            test_many_sleeping_sched();
+            test_steal_sched();
+            test_priority_sched();
+            test_preempt_sched();
+            test_blocked_sched();
+            test_park_sched();
+            test_future_sched();
+            test_cancel_sched();
+            test_sync_sched();
+            ENGIN.stop_all();
+        }, nullptr);
+    }
 
     ENGIN.run();
+    SPDLOG(INFO, "{} checks failed", g_failed_checks.load());
+    return g_failed_checks > 0 ? 1 : 0;
 }
\ No newline at end of file
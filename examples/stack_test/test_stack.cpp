@@ -2,6 +2,17 @@
 
 using namespace chr;
 
+// a failed check is logged, and makes the exit code non-zero (see main)
+static std::atomic<int> g_failed_checks(0);
+
+#define CHECK(cond) do { \
+    if (!(cond)) { \
+        g_failed_checks++; \
+        SPDLOG(ERROR, "check failed at line {}: {}", __LINE__, #cond); \
+        fprintf(stderr, "check failed at line %d: %s\n", __LINE__, #cond); \
+    } \
+} while (0)
+
 void test_stack() {
     for (int i = 0; i < 1000; i++) {
         ENGIN.create_chroutine([i](void *){
@@ -12,12 +23,122 @@ void test_stack() {
     }
 }
 
+// small private stacks, recycled by the stack pool of the thread
+void test_stack_size() {
+    static const int COUNT = 1000;
+    static const int SONS = 3;
+    static std::atomic<int> done(0);
+    ENGIN.enable_stack_painting(true);
+    chroutine_attr_t attr;
+    attr.stack_size = 16*1024;
+    attr.tag = "test_stack_size";
+    for (int i = 0; i < COUNT; i++) {
+        ENGIN.create_chroutine([i, attr](void *){
+            for (int k = 0; k < SONS; k++) {
+                SLEEP(i%50+10);
+                // finished chroutine gives its stack back to the pool
+                ENGIN.create_son_chroutine([](void *){
+                    SLEEP(10);
+                    done++;
+                }, nullptr, attr);
+            }
+            done++;
+        }, nullptr, attr);
+    }
+
+    for (int i = 0; i < 300 && done < COUNT * (SONS + 1); i++) {
+        SLEEP(10);
+    }
+    SLEEP(10);
+    CHECK(done == COUNT * (SONS + 1));
+    stack_usage_map_t usage = ENGIN.stack_usage();
+    CHECK(usage.count(attr.tag) == 1);
+    CHECK(usage[attr.tag].count == COUNT * (SONS + 1));
+    CHECK(usage[attr.tag].stack_size == stack_pool_t::round_size(attr.stack_size));
+}
+
+// paint the stacks and check the high-water marks by tag
+void test_stack_usage() {
+    static const int COUNT = 100;
+    static const size_t BUF_SIZE = 1024;
+    static std::atomic<int> kept(0);
+    ENGIN.enable_stack_painting(true);
+    chroutine_attr_t attr;
+    attr.stack_class = stack_class_32k;
+    attr.tag = "test_stack_usage";
+    for (int i = 0; i < COUNT; i++) {
+        ENGIN.create_chroutine([i](void *){
+            char buf[BUF_SIZE];
+            memset(buf, 0, (i+1)*10);
+            SLEEP(10);
+            // read it back, or the compiler may drop the memset
+            if (buf[i*10] == 0) {
+                kept++;
+            }
+        }, nullptr, attr);
+    }
+
+    stack_usage_map_t usage;
+    for (int i = 0; i < 300; i++) {
+        SLEEP(10);
+        usage = ENGIN.stack_usage();
+        if (usage.count(attr.tag) && usage[attr.tag].count == COUNT) {
+            break;
+        }
+    }
+    for (auto &it : usage) {
+        SPDLOG(INFO, "stack usage of [{}]: count {}, max {} bytes, avg {} bytes, stack size {}"
+            , it.first
+            , it.second.count
+            , it.second.max_used
+            , it.second.total_used / it.second.count
+            , it.second.stack_size);
+    }
+    const stack_usage_t &mine = usage[attr.tag];
+    CHECK(mine.count == COUNT);
+    CHECK(kept == COUNT);
+    // the biggest one touched COUNT*10 bytes of buf, below the frames of the engine
+    CHECK(mine.max_used >= COUNT * 10);
+    CHECK(mine.max_used < mine.stack_size);
+    CHECK(mine.total_used / mine.count <= mine.max_used);
+    CHECK(mine.stack_size == STACK_CLASS_SIZES[stack_class_32k]);
+}
+
+// all chroutines run on the shared stack of the thread,
+// only the used part of the stack is kept for each of them.
+void test_shared_stack() {
+    chroutine_attr_t attr;
+    attr.shared_stack = true;
+    for (int i = 0; i < 100000; i++) {
+        ENGIN.create_chroutine([i](void *){
+            char buf[256];
+            memset(buf, i & 0xff, sizeof(buf));
+            while (1) {
+                SLEEP(i%1000+10);
+                if (buf[i%sizeof(buf)] != (char)(i & 0xff)) {
+                    SPDLOG(ERROR, "chroutine {} stack broken!", i);
+                }
+            }
+        }, nullptr, attr);
+    }
+}
 
 int main(int argc, char **argv)
 {
     ENGINE_INIT(1);
 
-    test_stack();
+    // these run forever, call one of them instead of the checked ones to watch it
+    // test_stack();
+    // test_shared_stack();
+
+    // the checked ones run one by one, then the engine stops
+    ENGIN.create_chroutine([](void *){
+        test_stack_size();
+        test_stack_usage();
+        ENGIN.stop_all();
+    }, nullptr);
 
     ENGIN.run();
+    SPDLOG(INFO, "{} checks failed", g_failed_checks.load());
+    return g_failed_checks > 0 ? 1 : 0;
 }
\ No newline at end of file
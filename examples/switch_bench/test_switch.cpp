@@ -0,0 +1,82 @@
+#include <ucontext.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+#include "context.hpp"
+
+using namespace chr;
+
+// ping-pong between the main context and one chroutine context,
+// a round trip counts two switches.
+
+static const long ROUNDS = 5000000;
+static const size_t BENCH_STACK_SIZE = 64 * 1024;
+
+static context_t s_main_ctx;
+static context_t s_co_ctx;
+
+static ucontext_t s_main_uc;
+static ucontext_t s_co_uc;
+
+static void ctx_loop(void *)
+{
+    for (;;) {
+        context_swap(&s_co_ctx, &s_main_ctx);
+    }
+}
+
+static void uc_loop()
+{
+    for (;;) {
+        swapcontext(&s_co_uc, &s_main_uc);
+    }
+}
+
+static double now_ns()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static double bench_context_t()
+{
+    char *stack = new char[BENCH_STACK_SIZE];
+    context_make(&s_co_ctx, stack, BENCH_STACK_SIZE, ctx_loop, nullptr);
+
+    double begin = now_ns();
+    for (long i = 0; i < ROUNDS; i++) {
+        context_swap(&s_main_ctx, &s_co_ctx);
+    }
+    double cost = now_ns() - begin;
+    // the chroutine never finishes, its stack is leaked on purpose
+    return cost / (ROUNDS * 2);
+}
+
+static double bench_swapcontext()
+{
+    char *stack = new char[BENCH_STACK_SIZE];
+    getcontext(&s_co_uc);
+    s_co_uc.uc_stack.ss_sp = stack;
+    s_co_uc.uc_stack.ss_size = BENCH_STACK_SIZE;
+    s_co_uc.uc_link = nullptr;
+    makecontext(&s_co_uc, uc_loop, 0);
+
+    double begin = now_ns();
+    for (long i = 0; i < ROUNDS; i++) {
+        swapcontext(&s_main_uc, &s_co_uc);
+    }
+    double cost = now_ns() - begin;
+    return cost / (ROUNDS * 2);
+}
+
+int main(int argc, char **argv)
+{
+    double uc_ns = bench_swapcontext();
+    double ctx_ns = bench_context_t();
+
+    printf("switches:              %ld\n", ROUNDS * 2);
+    printf("glibc swapcontext:     %.2f ns/switch\n", uc_ns);
+    printf("context_t (%s): %.2f ns/switch\n", context_backend(), ctx_ns);
+    printf("speedup:               %.2fx\n", uc_ns / ctx_ns);
+    return 0;
+}
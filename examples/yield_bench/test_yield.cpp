@@ -0,0 +1,76 @@
+#include <stdio.h>
+#include <chrono>
+#include "engine.hpp"
+
+using namespace chr;
+
+// chroutines yielding on a single worker in turn, so a YIELD is
+// the macro, the ready queue and two context switches.
+
+static const long YIELDS = 2000000;
+static const long LOOKUPS = 10000000;
+static const int CASES[] = {1, 16, 256};
+
+static long s_yields = 0;
+static int s_alive = 0;
+
+static double now_ns()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void bench_yield(int chroutines)
+{
+    long each = YIELDS / chroutines;
+    s_yields = 0;
+    s_alive = chroutines;
+    chroutine_attr_t attr;
+    attr.placement = placement_t::local;
+    for (int i = 0; i < chroutines; i++) {
+        ENGIN.create_chroutine([each](void *){
+            for (long n = 0; n < each; n++) {
+                YIELD();
+                s_yields++;
+            }
+            s_alive--;
+        }, nullptr, attr);
+    }
+
+    double begin = now_ns();
+    while (s_alive > 0) {
+        YIELD();
+        s_yields++;
+    }
+    double cost = now_ns() - begin;
+    printf("%-12d %-12ld %.2f\n", chroutines, s_yields, cost / s_yields);
+}
+
+static void bench_current_id()
+{
+    chroutine_id_t sum = 0;
+    double begin = now_ns();
+    for (long i = 0; i < LOOKUPS; i++) {
+        sum += ENGIN.get_current_chroutine_id();
+    }
+    double cost = now_ns() - begin;
+    printf("get_current_chroutine_id: %.2f ns/call (%ld)\n", cost / LOOKUPS, static_cast<long>(sum & 1));
+}
+
+int main(int argc, char **argv)
+{
+    ENGINE_INIT(1);
+
+    // one worker, so nothing is stolen or placed elsewhere
+    ENGIN.create_chroutine([](void *){
+        printf("chroutines   yields       ns/YIELD\n");
+        for (int chroutines : CASES) {
+            bench_yield(chroutines);
+        }
+        bench_current_id();
+        ENGIN.stop_all();
+    }, nullptr);
+
+    ENGIN.run();
+    return 0;
+}
@@ -45,11 +45,15 @@ int raw_tcp_client_t::connect()
             SPDLOG(DEBUG, "{} connect to {}:{} waiting for connection tobe done", __FUNCTION__, m_host, m_port);
 
             int conn_result = -1;    // -2 timeout, -1 failure, 0 success
-            ENGIN.create_son_chroutine([&](void *) {
+            chroutine_attr_t timer_attr;
+            timer_attr.token = cancel_token_t::create();
+            ENGIN.create_son_chroutine([this](void *) {
                 SLEEP(15000);    // timeout in 15 seconds
                 (*m_conn_result_chan) << -2;
-            }, nullptr);
+            }, nullptr, timer_attr);
             (*m_conn_result_chan) >> conn_result;
+            // stop the timer, or it writes to the channel when nobody reads
+            timer_attr.token.cancel();
 
             if (conn_result != 0) {
                 SPDLOG(ERROR, "{} connect to {}:{} failed, conn_result={}", __FUNCTION__, m_host, m_port, conn_result);
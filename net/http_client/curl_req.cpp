@@ -123,8 +123,10 @@ void curl_req_t::on_rsp(long rsp_code, long data_result)
 {
     rsp().set_rsp_code(rsp_code);
     rsp().set_curl_code(data_result);
-    if (m_my_chroutine != INVALID_ID) {
-        ENGIN.awake_chroutine(m_my_chroutine);
+    m_done.store(true);
+    chroutine_id_t waiting = m_my_chroutine;
+    if (waiting != INVALID_ID) {
+        ENGIN.unpark(waiting);
     }
 }
 
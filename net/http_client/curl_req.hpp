@@ -15,6 +15,7 @@
 #include <string>
 #include <memory>
 #include <ctime>
+#include <atomic>
 
 #include "chroutine.hpp"
 
@@ -99,6 +100,11 @@ public:
         m_my_chroutine = id;
     }
 
+    // whether on_rsp was called
+    bool done() {
+        return m_done.load();
+    }
+
     void on_rsp(long rsp_code, long data_result);
 
     void set_post_data(uint8_t *data, uint32_t len);
@@ -111,7 +117,8 @@ private:
     EN_CURL_TYPE    m_type = EN_CURL_TYPE_GET;
     unsigned int    m_req_id = 0;
     curl_rsp_t      m_rsp;
-	chroutine_id_t  m_my_chroutine = INVALID_ID;
+	std::atomic<chroutine_id_t> m_my_chroutine{INVALID_ID};
+    std::atomic<bool>           m_done{false};
 
     uint8_t *       m_post_buf = nullptr;
     uint32_t        m_post_buf_len = 0;
@@ -64,15 +64,28 @@ std::shared_ptr<curl_rsp_t> curl_stub_t::exec_curl(const std::string & url
 
     push_curl_req(req);
 
-    // wait req to be done
-    if (timeout > 0) {
-        reporter_base_t * rpt = ENGIN.create_son_chroutine([](void *d) {
-            while (1) {SLEEP(10000);}
-        }, reporter_t<curl_call_wait_t>::create(), timeout);
-        
-        if (rpt) {
-            SPDLOG(DEBUG, "curl_call_wait_t, call result:{}", rpt->get_result());
+    // wait req to be done, curl times it out by itself anyway.
+    // parking stops at the deadline of the chroutine's token too, and throws if cancelled
+    std::time_t deadline = timeout > 0 ? mono_clock_t::now_ms() + timeout : 0;
+    try {
+        while (!p_req->done()) {
+            std::time_t left = 0;
+            if (deadline != 0) {
+                left = deadline - mono_clock_t::now_ms();
+                if (left <= 0) {
+                    break;
+                }
+            }
+            ENGIN.park(left);
         }
+    } catch (const chroutine_cancelled_t &) {
+        p_req->set_my_chroutine_id(INVALID_ID);
+        throw;
+    }
+    if (!p_req->done()) {
+        SPDLOG(DEBUG, "exec_curl timed out after {} ms, url:{}", timeout, url);
+        // don't unpark us when it's done later
+        p_req->set_my_chroutine_id(INVALID_ID);
     }
 
     // get rsp from req
@@ -38,7 +38,6 @@ public:
 
 private:
     curl_stub_t();
-	typedef struct {}curl_call_wait_t;
     typedef std::deque<std::shared_ptr<curl_req_t> > curl_req_que_t;
     typedef std::unordered_map<void *, std::shared_ptr<curl_req_t> > curl_req_map_t;
 
@@ -9,6 +9,7 @@
 #ifndef __GRPC_SYNC_CLIENT_FOR_CHROUTINE_H__
 #define __GRPC_SYNC_CLIENT_FOR_CHROUTINE_H__
 
+#include <atomic>
 #include "grpc_async_client.hpp"
 #include "engine.hpp"
 
@@ -25,7 +26,7 @@ public:
 
 
 	client_sync_call_t(client_sync_call_t &other) : client_call_it(other.m_client_ptr) {
-		m_my_chroutine = other.m_my_chroutine;
+		m_my_chroutine = other.m_my_chroutine.load();
 		m_chroutine_timeout_ms = other.m_chroutine_timeout_ms;
 		m_result = other.m_result;
 	}
@@ -46,9 +47,11 @@ public:
 	}
 	
 	virtual int on_rsp() {
-		// awake calling chroutine
-		if (m_my_chroutine != INVALID_ID) {
-			ENGIN.awake_chroutine(m_my_chroutine);
+		// awake calling chroutine, it may not be parking yet
+		m_done.store(true);
+		chroutine_id_t waiting = m_my_chroutine;
+		if (waiting != INVALID_ID) {
+			ENGIN.unpark(waiting);
 		}
         return 0;
 	}
@@ -63,20 +66,28 @@ public:
 	}
 
 protected:
-	typedef struct {
-
-	}rpc_call_wait_t;
-
 	virtual int wait_call() {
 		// current chroutine goes to wait
 		m_my_chroutine = ENGIN.get_current_chroutine_id();
 		if (m_my_chroutine != INVALID_ID && m_chroutine_timeout_ms > 0) {
-            reporter_base_t * rpt = ENGIN.create_son_chroutine([](void *d) {
-				while (1) {SLEEP(10000);}
-			}, reporter_t<rpc_call_wait_t>::create(), m_chroutine_timeout_ms);
-			
-			if (rpt) {
-				SPDLOG(DEBUG, "wait_call, call result:{}, status.ok:{}", rpt->get_result(), m_status.ok());
+			std::time_t deadline = mono_clock_t::now_ms() + m_chroutine_timeout_ms;
+			try {
+				while (!m_done.load()) {
+					std::time_t left = deadline - mono_clock_t::now_ms();
+					if (left <= 0) {
+						break;
+					}
+					ENGIN.park(left);
+				}
+			} catch (const chroutine_cancelled_t &) {
+				// the call is left to grpc, don't unpark us when it's done
+				m_my_chroutine = INVALID_ID;
+				throw;
+			}
+			SPDLOG(DEBUG, "wait_call, done:{}, status.ok:{}", m_done.load(), m_status.ok());
+			if (!m_done.load()) {
+				// don't unpark us when it's done later
+				m_my_chroutine = INVALID_ID;
 			}
 		}
 		// 
@@ -85,7 +96,8 @@ protected:
 public:
 	RESULT_T m_result;
 private:
-	chroutine_id_t m_my_chroutine = INVALID_ID;
+	std::atomic<chroutine_id_t> m_my_chroutine{INVALID_ID};
+	std::atomic<bool> m_done{false};
 	int m_chroutine_timeout_ms = 0;
 };
 
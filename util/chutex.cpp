@@ -1,26 +1,194 @@
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
 #include "chutex.hpp"
 #include "engine.hpp"
+#include "slab.hpp"
 
 namespace chr {
 
+namespace {
+
+inline void cpu_relax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield" ::: "memory");
+#endif
+}
+
+void futex_wait(std::atomic<int> *word, int value)
+{
+    syscall(SYS_futex, reinterpret_cast<int *>(word), FUTEX_WAIT_PRIVATE, value, nullptr, nullptr, 0);
+}
+
+void futex_wake(int *word)
+{
+    syscall(SYS_futex, word, FUTEX_WAKE_PRIVATE, 1, nullptr, nullptr, 0);
+}
+
+}
+
 void chutex_t::lock()
 {
-    bool expected = false;
-    while(!m_flag.compare_exchange_weak(expected, true, std::memory_order_acquire)) {
-        expected = false;
-        YIELD();
+    int expected = 0;
+    if (m_state.compare_exchange_strong(expected, 1, std::memory_order_acquire)) {
+        return;
     }
+
+    for (int i = 0; i < CHUTEX_SPIN_ROUNDS; i++) {
+        cpu_relax();
+        if (m_state.load(std::memory_order_relaxed) == 0 && try_lock()) {
+            return;
+        }
+    }
+    lock_slow();
 }
 
-void chutex_t::unlock() 
+void chutex_t::unlock()
 {
-    m_flag.store(false, std::memory_order_release);
+    int expected = 1;
+    if (m_state.compare_exchange_strong(expected, 0, std::memory_order_release)) {
+        return;
+    }
+    unlock_slow();
 }
 
-bool chutex_t::try_lock() 
+bool chutex_t::try_lock()
 {
-    bool expected = false;
-    return m_flag.compare_exchange_strong(expected, true, std::memory_order_acquire);
+    int expected = 0;
+    return m_state.compare_exchange_strong(expected, 1, std::memory_order_acquire);
 }
 
-}
\ No newline at end of file
+void chutex_t::lock_slow()
+{
+    waiter_t *me = new waiter_t();
+    me->chroutine = ENGIN.get_current_chroutine_id();
+
+    lock_queue();
+    int state = m_state.load(std::memory_order_relaxed);
+    for (;;) {
+        if (state == 0) {
+            if (m_state.compare_exchange_weak(state, 1, std::memory_order_acquire)) {
+                unlock_queue();
+                delete me;
+                return;
+            }
+        } else if (state == 1) {
+            // unlock takes the slow way from now on, and finds us in the queue
+            if (m_state.compare_exchange_weak(state, 2, std::memory_order_relaxed)) {
+                break;
+            }
+        } else {
+            break;
+        }
+    }
+    if (m_tail) {
+        m_tail->next = me;
+    } else {
+        m_head = me;
+    }
+    m_tail = me;
+    unlock_queue();
+
+    if (me->chroutine == INVALID_ID) {
+        while (me->handed.load(std::memory_order_acquire) == 0) {
+            futex_wait(&me->handed, 0);
+        }
+        delete me;
+        return;
+    }
+
+    try {
+        while (me->handed.load(std::memory_order_acquire) == 0) {
+            ENGIN.park();
+        }
+    } catch (const chroutine_cancelled_t &) {
+        if (!dequeue(me)) {
+            // it's being handed over to us, wait for it and pass it on
+            while (me->handed.load(std::memory_order_acquire) == 0) {
+                cpu_relax();
+            }
+            unlock();
+        }
+        delete me;
+        throw;
+    }
+    delete me;
+}
+
+void chutex_t::unlock_slow()
+{
+    lock_queue();
+    waiter_t *waiter = m_head;
+    if (waiter == nullptr) {
+        m_state.store(0, std::memory_order_release);
+        unlock_queue();
+        return;
+    }
+    m_head = waiter->next;
+    if (m_head == nullptr) {
+        m_tail = nullptr;
+    }
+    // still locked, by the waiter now
+    m_state.store(m_head ? 2 : 1, std::memory_order_relaxed);
+    unlock_queue();
+
+    // the waiter may return and its frame go once handed is set, keep what we need
+    int64_t chroutine = waiter->chroutine;
+    int *word = reinterpret_cast<int *>(&waiter->handed);
+    waiter->handed.store(1, std::memory_order_release);
+    if (chroutine == INVALID_ID) {
+        futex_wake(word);
+    } else {
+        ENGIN.unpark(chroutine);
+    }
+}
+
+bool chutex_t::dequeue(waiter_t *waiter)
+{
+    lock_queue();
+    waiter_t *prev = nullptr;
+    for (waiter_t *w = m_head; w; prev = w, w = w->next) {
+        if (w != waiter) {
+            continue;
+        }
+        if (prev) {
+            prev->next = w->next;
+        } else {
+            m_head = w->next;
+        }
+        if (m_tail == w) {
+            m_tail = prev;
+        }
+        if (m_head == nullptr) {
+            m_state.store(1, std::memory_order_relaxed);
+        }
+        unlock_queue();
+        return true;
+    }
+    unlock_queue();
+    return false;
+}
+
+void *chutex_t::waiter_t::operator new(size_t size)
+{
+    return slab_t<waiter_t>::alloc();
+}
+
+void chutex_t::waiter_t::operator delete(void *p)
+{
+    slab_t<waiter_t>::free(p);
+}
+
+void chutex_t::lock_queue()
+{
+    while (m_queue_locked.exchange(true, std::memory_order_acquire)) {
+        while (m_queue_locked.load(std::memory_order_relaxed)) {
+            cpu_relax();
+        }
+    }
+}
+
+}
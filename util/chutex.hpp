@@ -1,7 +1,16 @@
 /// \file chutex.hpp
-/// 
+///
 /// mutex for chroutine
 ///
+/// lock() spins a little, then waits in a FIFO queue: a chroutine is parked,
+/// a plain thread (or a worker out of any chroutine) sleeps on a futex.
+/// unlock() hands the lock to the first waiter directly, so a newcomer can't barge in,
+/// and no waiter is woken just to fail again.
+///
+/// the queue node of a waiter is taken from the slab, not from its stack:
+/// unlock() writes it while the waiter is switched out, and the stack of a
+/// shared-stack chroutine holds the frames of another one by then.
+///
 /// \author ingangi
 /// \version 0.1.0
 /// \date 2019-03-28
@@ -9,13 +18,25 @@
 #ifndef CHUTEX_HPP
 #define CHUTEX_HPP
 
+#include <stddef.h>
+#include <stdint.h>
 #include <atomic>
 
 namespace chr {
 
-// it's a spin lock
+const int CHUTEX_SPIN_ROUNDS = 64;  // tries before queueing, the holder may be about to unlock
+
 class chutex_t final
 {
+    typedef struct waiter_t {
+        int64_t             chroutine = -1;     // -1: a thread sleeping on the futex of handed
+        std::atomic<int>    handed{0};          // 1: the lock is handed over to it
+        waiter_t *          next = nullptr;
+
+        static void *operator new(size_t size);
+        static void operator delete(void *p);
+    } waiter_t;
+
 public:
     chutex_t(){}
     ~chutex_t(){}
@@ -25,17 +46,32 @@ public:
     // can unlock by others
     void unlock();
 
-    // 
+    //
     bool try_lock();
-    
+
 private:
     chutex_t(const chutex_t&) = delete;
     chutex_t(chutex_t&&) = delete;
     chutex_t& operator=(const chutex_t&) = delete;
     chutex_t& operator=(chutex_t&&) = delete;
 
+    void lock_slow();
+    void unlock_slow();
+
+    // leave the queue, false if it was taken out by unlock
+    bool dequeue(waiter_t *waiter);
+
+    // the queue is locked for a few instructions only
+    void lock_queue();
+    void unlock_queue() {
+        m_queue_locked.store(false, std::memory_order_release);
+    }
+
 private:
-    std::atomic<bool> m_flag = ATOMIC_VAR_INIT(false);    //true:locked
+    std::atomic<int>    m_state{0};         // 0: unlocked, 1: locked, 2: locked with waiters
+    std::atomic<bool>   m_queue_locked{false};
+    waiter_t *          m_head = nullptr;
+    waiter_t *          m_tail = nullptr;
 };
 
 class chutex_guard_t final
@@ -53,4 +89,4 @@ private:
 
 }
 
-#endif
\ No newline at end of file
+#endif
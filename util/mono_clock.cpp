@@ -0,0 +1,105 @@
+#include <time.h>
+#include <stdint.h>
+#include "mono_clock.hpp"
+
+#if defined(CHR_USE_TSC) && defined(__x86_64__)
+#include <cpuid.h>
+#include <x86intrin.h>
+#define CHR_TSC_CLOCK
+#endif
+
+namespace chr {
+
+namespace {
+
+std::time_t clock_us()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<std::time_t>(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+}
+
+#ifdef CHR_TSC_CLOCK
+const int CALIBRATE_US = 10000;
+
+// the TSC ticks mapped to CLOCK_MONOTONIC, made once
+typedef struct tsc_base_t {
+    bool        usable = false;
+    uint64_t    tsc = 0;
+    std::time_t us = 0;
+    uint64_t    us_per_tick = 0;    // in 1/2^32 us
+} tsc_base_t;
+
+bool tsc_invariant()
+{
+    unsigned int eax, ebx, ecx, edx;
+    if (__get_cpuid(0x80000000, &eax, &ebx, &ecx, &edx) == 0 || eax < 0x80000007) {
+        return false;
+    }
+    __get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx);
+    return (edx & (1 << 8)) != 0;
+}
+
+tsc_base_t calibrate()
+{
+    tsc_base_t base;
+    if (!tsc_invariant()) {
+        return base;
+    }
+
+    // spin a while, short enough for the first caller, long enough for ~0.01% error
+    std::time_t begin_us = clock_us();
+    uint64_t begin_tsc = __rdtsc();
+    std::time_t end_us = begin_us;
+    while (end_us - begin_us < CALIBRATE_US) {
+        end_us = clock_us();
+    }
+    uint64_t end_tsc = __rdtsc();
+    if (end_tsc <= begin_tsc) {
+        return base;
+    }
+
+    base.usable = true;
+    base.tsc = end_tsc;
+    base.us = end_us;
+    base.us_per_tick = (static_cast<uint64_t>(end_us - begin_us) << 32) / (end_tsc - begin_tsc);
+    return base;
+}
+
+const tsc_base_t & tsc_base()
+{
+    static tsc_base_t base = calibrate();
+    return base;
+}
+#endif
+
+}
+
+thread_local std::time_t mono_clock_t::ms_cached_us = 0;
+thread_local bool mono_clock_t::ms_scheduler = false;
+
+bool mono_clock_t::tsc_enabled()
+{
+#ifdef CHR_TSC_CLOCK
+    return tsc_base().usable;
+#else
+    return false;
+#endif
+}
+
+std::time_t mono_clock_t::read_us()
+{
+#ifdef CHR_TSC_CLOCK
+    const tsc_base_t & base = tsc_base();
+    if (base.usable) {
+        // another cpu may read a few ticks before the base
+        int64_t delta = static_cast<int64_t>(__rdtsc() - base.tsc);
+        // 128 bits, the ticks since the base times us_per_tick overflow 64 bits in seconds
+        unsigned __int128 ticks = delta > 0 ? delta : 0;
+        return base.us + static_cast<std::time_t>((ticks * base.us_per_tick) >> 32);
+    }
+#endif
+    return clock_us();
+}
+
+}
@@ -0,0 +1,75 @@
+/// \file mono_clock.hpp
+///
+/// mono_clock_t is the clock of the scheduler. it's monotonic, so stepping the wall clock
+/// (NTP, date -s) wakes or stalls no sleeper, and it's in microseconds.
+///
+/// each thread keeps the time it read last, the scheduler refreshes it once
+/// every round, and things not needing an exact time (parking, checking the
+/// deadlines) just take the cached one.
+/// code shared with plain threads takes round_us(), as nobody refreshes theirs.
+///
+/// built with CHR_USE_TSC on x86-64, it reads the TSC instead of clock_gettime,
+/// calibrated against CLOCK_MONOTONIC the first time. it falls back to clock_gettime
+/// if the TSC is not invariant (it may stop or change rate with the cpu).
+///
+/// \author ingangi
+/// \version 0.1.0
+/// \date 2026-10-17
+
+#ifndef MONO_CLOCK_HPP
+#define MONO_CLOCK_HPP
+
+#include <ctime>
+
+namespace chr {
+
+class mono_clock_t final
+{
+public:
+    // read the clock, in us. it's also cached for this thread
+    static std::time_t now_us() {
+        ms_cached_us = read_us();
+        return ms_cached_us;
+    }
+
+    static std::time_t now_ms() {
+        return now_us() / 1000;
+    }
+
+    // the time read last by this thread, in us
+    static std::time_t cached_us() {
+        return ms_cached_us;
+    }
+
+    static std::time_t cached_ms() {
+        return ms_cached_us / 1000;
+    }
+
+    // the cached time on a scheduler thread, a fresh one on others
+    static std::time_t round_us() {
+        return ms_scheduler ? ms_cached_us : now_us();
+    }
+
+    static std::time_t round_ms() {
+        return round_us() / 1000;
+    }
+
+    // called by a scheduler thread before its first round, it refreshes the cache since then
+    static void set_scheduler() {
+        ms_scheduler = true;
+    }
+
+    // whether the TSC is read, see CHR_USE_TSC
+    static bool tsc_enabled();
+
+private:
+    static std::time_t read_us();
+
+private:
+    static thread_local std::time_t ms_cached_us;
+    static thread_local bool        ms_scheduler;
+};
+
+}
+
+#endif
@@ -13,6 +13,7 @@
 
 namespace chr {
 
+// wall clock in ms, the scheduler keeps the time by mono_clock_t
 std::time_t get_time_stamp();
 void thread_ms_sleep(uint32_t ms);
 std::string readable_thread_id(const std::thread::id & id);